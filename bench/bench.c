@@ -0,0 +1,431 @@
+/**
+ * @file bench.c
+ *
+ * End-to-end benchmark of the compressor (lz77-bench).
+ * For each corpus (see corpus.h) and each combination of window length,
+ * look ahead length and mode it measures:
+ *  - compression and decompression speed in MB/s (best of -r runs)
+ *  - compression ratio (original size / compressed size)
+ *  - peak RSS of the process that does the work
+ * Every combination runs in its own child process, so the peak RSS is the
+ * one of that run only and a run too slow can be stopped (-T seconds).
+ * The decompressed data is always compared with the original one.
+ *
+ * The results are printed as a table and, with -o, written in CSV format.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "corpus.h"
+#include "../include/lz77.h"
+
+#define MAX_LIST 16
+
+/**
+ * A mode is a set of options applied to the compressor, it's used to
+ * compare the features of the software (checksums, ...).
+ */
+struct bench_mode{
+	const char *name;
+	void (*apply)(struct options *opt);
+};
+
+static void apply_plain(struct options *opt)
+{
+}
+
+static void apply_checksum(struct options *opt)
+{
+	opt->checksum = 1;
+}
+
+static void apply_fast(struct options *opt)
+{
+	opt->max_visits = 48;
+	opt->nice_len = 32;
+	opt->max_depth = 48;
+}
+
+static void apply_bytes(struct options *opt)
+{
+	opt->fast_decode = 1;
+}
+
+static void apply_fixed(struct options *opt)
+{
+	opt->block_widths = 0;
+}
+
+static const struct bench_mode modes[] = {
+	{ "plain", apply_plain },
+	{ "checksum", apply_checksum },
+	{ "fast", apply_fast },
+	{ "bytes", apply_bytes },
+	{ "fixed", apply_fixed },
+	{ NULL, NULL }
+};
+
+/* status of a run */
+#define RUN_OK 0
+#define RUN_MISMATCH 1	// the decompressed data is different
+#define RUN_ERROR 2	// encode() or decode() failed
+#define RUN_TIMEOUT 3
+
+static const char *status_names[] = { "ok", "MISMATCH", "ERROR", "TIMEOUT" };
+
+struct result{
+	int status;
+	double compress_time;	// seconds
+	double decompress_time;
+	long compressed_size;
+	long peak_rss;		// KiB
+};
+
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Parse a list of numbers separated by commas.
+ *
+ * @return the number of values, -1 if the list isn't correct
+ */
+static int parse_list(char *arg, int *values)
+{
+	char *tok;
+	int n = 0;
+
+	for(tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ",")){
+		if(n == MAX_LIST || atoi(tok) <= 0)
+			return -1;
+		values[n++] = atoi(tok);
+	}
+	return n;
+}
+
+/**
+ * Compare two files.
+ *
+ * @return 1 if they have the same content, 0 otherwise
+ */
+static int same_content(const char *f1, const char *f2)
+{
+	FILE *a = fopen(f1, "r");
+	FILE *b = fopen(f2, "r");
+	char buf_a[65536], buf_b[65536];
+	size_t na, nb;
+	int same = (a != NULL && b != NULL);
+
+	while(same){
+		na = fread(buf_a, 1, sizeof(buf_a), a);
+		nb = fread(buf_b, 1, sizeof(buf_b), b);
+		if(na != nb || memcmp(buf_a, buf_b, na) != 0)
+			same = 0;
+		if(na == 0)
+			break;
+	}
+
+	if(a != NULL)
+		fclose(a);
+	if(b != NULL)
+		fclose(b);
+	return same;
+}
+
+/**
+ * Executed by the child process: compress and decompress the file reps times
+ * and send the result through the pipe fd.
+ */
+static void child_run(int fd, char *input, char *compressed, char *output,
+		      int window, int look, const struct bench_mode *mode, int reps, int timeout)
+{
+	struct options opt;
+	struct result res;
+	struct stat st;
+	double start, elapsed;
+	int i;
+
+	// the compressor prints its options
+	if(freopen("/dev/null", "w", stdout) == NULL)
+		_exit(1);
+	alarm(timeout);
+
+	memset(&res, 0, sizeof(res));
+	res.compress_time = res.decompress_time = 1e30;
+
+	for(i = 0; i < reps && res.status == RUN_OK; i++){
+		init_opt(&opt);
+		opt.mode = COMPRESSION;
+		opt.file_in = input;
+		opt.file_out = compressed;
+		opt.window_len = window;
+		opt.look_ahead_len = look;
+		mode->apply(&opt);
+
+		remove(compressed);
+		start = now();
+		if(encode(opt) == -1)
+			res.status = RUN_ERROR;
+		elapsed = now() - start;
+		if(elapsed < res.compress_time)
+			res.compress_time = elapsed;
+	}
+
+	for(i = 0; i < reps && res.status == RUN_OK; i++){
+		init_opt(&opt);
+		opt.mode = DECOMPRESSION;
+		opt.file_in = compressed;
+		opt.file_out = output;
+
+		remove(output);
+		start = now();
+		if(decode(opt) == -1)
+			res.status = RUN_ERROR;
+		elapsed = now() - start;
+		if(elapsed < res.decompress_time)
+			res.decompress_time = elapsed;
+	}
+
+	if(res.status == RUN_OK && !same_content(input, output))
+		res.status = RUN_MISMATCH;
+	if(stat(compressed, &st) == 0)
+		res.compressed_size = st.st_size;
+
+	if(write(fd, &res, sizeof(res)) != sizeof(res))
+		_exit(1);
+	_exit(0);
+}
+
+/**
+ * Run a combination in a child process.
+ */
+static struct result run(char *input, char *compressed, char *output,
+			 int window, int look, const struct bench_mode *mode, int reps, int timeout)
+{
+	struct result res;
+	struct rusage usage;
+	int fd[2], status;
+	pid_t pid;
+
+	memset(&res, 0, sizeof(res));
+	res.status = RUN_ERROR;
+
+	if(pipe(fd) == -1)
+		return res;
+
+	fflush(stdout);
+	pid = fork();
+	if(pid == -1){
+		close(fd[0]);
+		close(fd[1]);
+		return res;
+	}
+	if(pid == 0){
+		close(fd[0]);
+		child_run(fd[1], input, compressed, output, window, look, mode, reps, timeout);
+	}
+
+	close(fd[1]);
+	if(read(fd[0], &res, sizeof(res)) != sizeof(res))
+		res.status = RUN_ERROR;
+	close(fd[0]);
+
+	if(wait4(pid, &status, 0, &usage) == pid){
+		if(WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM)
+			res.status = RUN_TIMEOUT;
+		res.peak_rss = usage.ru_maxrss;
+	}
+
+	return res;
+}
+
+static void bench_usage(void)
+{
+	int i;
+
+	printf("Usage: ./lz77-bench [options]\n\n");
+	printf("options \n");
+	printf("  -s KIB\tSize of the synthetic corpora in KiB (default 256)\n");
+	printf("  -r N\tRepetitions for each run, the best time is used (default 3)\n");
+	printf("  -w LIST\tWindow lengths separated by commas (default 1024,4096,32767)\n");
+	printf("  -l LIST\tLook ahead lengths separated by commas (default 16,64,255)\n");
+	printf("  -m LIST\tModes separated by commas (default all)\n");
+	printf("  -c LIST\tCorpora separated by commas (default all)\n");
+	printf("  -o FILE\tWrite the results in CSV format, '-' is the standard output\n");
+	printf("  -d DIR\tDirectory for the temporary files (default /tmp)\n");
+	printf("  -T SEC\tTime limit for each run (default 60)\n");
+	printf("\nCorpora :");
+	for(i = 0; corpus_names[i] != NULL; i++)
+		printf(" %s", corpus_names[i]);
+	printf("\nModes :");
+	for(i = 0; modes[i].name != NULL; i++)
+		printf(" %s", modes[i].name);
+	printf("\n");
+}
+
+/**
+ * Check if name is in the list (comma separated), an empty list contains all names.
+ */
+static int in_list(const char *list, const char *name)
+{
+	const char *p = list;
+	size_t len = strlen(name);
+
+	if(list == NULL)
+		return 1;
+
+	while((p = strstr(p, name)) != NULL){
+		if((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+			return 1;
+		p += len;
+	}
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int windows[MAX_LIST] = { 1024, 4096, 32767 };
+	int looks[MAX_LIST] = { 16, 64, 255 };
+	int n_windows = 3, n_looks = 3;
+	size_t size = 256 * 1024;
+	int reps = 3, timeout = 60;
+	char *mode_list = NULL, *corpus_list = NULL;
+	char *csv_name = NULL, *dir = "/tmp";
+	char input[4096], compressed[4096], output[4096];
+	FILE *csv = NULL;
+	int c, i, j, k, m, failures = 0;
+
+	while((c = getopt(argc, argv, "hs:r:w:l:m:c:o:d:T:")) != -1){
+		switch(c){
+			case 's':
+				size = (size_t)atol(optarg) * 1024;
+				break;
+			case 'r':
+				reps = atoi(optarg);
+				break;
+			case 'w':
+				n_windows = parse_list(optarg, windows);
+				break;
+			case 'l':
+				n_looks = parse_list(optarg, looks);
+				break;
+			case 'm':
+				mode_list = optarg;
+				break;
+			case 'c':
+				corpus_list = optarg;
+				break;
+			case 'o':
+				csv_name = optarg;
+				break;
+			case 'd':
+				dir = optarg;
+				break;
+			case 'T':
+				timeout = atoi(optarg);
+				break;
+			default:
+				bench_usage();
+				return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if(size == 0 || reps <= 0 || timeout <= 0 || n_windows <= 0 || n_looks <= 0){
+		bench_usage();
+		return 1;
+	}
+
+	if(csv_name != NULL){
+		csv = strcmp(csv_name, "-") == 0 ? stdout : fopen(csv_name, "w");
+		if(csv == NULL){
+			printf("Error : can't create %s\n", csv_name);
+			return 1;
+		}
+		fprintf(csv, "corpus,size,window,look_ahead,mode,compressed,ratio,compress_mbps,decompress_mbps,peak_rss_kib,status\n");
+	}
+
+	snprintf(input, sizeof(input), "%s/lz77-bench-%d.in", dir, (int)getpid());
+	snprintf(compressed, sizeof(compressed), "%s/lz77-bench-%d.lz", dir, (int)getpid());
+	snprintf(output, sizeof(output), "%s/lz77-bench-%d.out", dir, (int)getpid());
+
+	printf("%-8s %8s %6s %4s %-9s %7s %10s %12s %9s %s\n",
+	       "corpus", "size", "window", "look", "mode", "ratio", "comp MB/s", "decomp MB/s", "RSS KiB", "status");
+
+	for(i = 0; corpus_names[i] != NULL; i++){
+		unsigned char *data;
+		size_t len;
+		FILE *f;
+
+		if(!in_list(corpus_list, corpus_names[i]))
+			continue;
+
+		data = corpus_generate(corpus_names[i], size, &len);
+		if(data == NULL){
+			printf("Error : can't generate the corpus %s\n", corpus_names[i]);
+			continue;
+		}
+		f = fopen(input, "w");
+		if(f == NULL || fwrite(data, 1, len, f) != len){
+			printf("Error : can't write %s\n", input);
+			free(data);
+			return 1;
+		}
+		fclose(f);
+		free(data);
+
+		for(j = 0; j < n_windows; j++)
+		for(k = 0; k < n_looks; k++)
+		for(m = 0; modes[m].name != NULL; m++){
+			struct result res;
+			double mb = len / 1e6;
+
+			if(!in_list(mode_list, modes[m].name) || looks[k] > windows[j])
+				continue;
+
+			res = run(input, compressed, output, windows[j], looks[k], &modes[m], reps, timeout);
+			if(res.status != RUN_OK)
+				failures++;
+
+			printf("%-8s %8zu %6d %4d %-9s %7.3f %10.2f %12.2f %9ld %s\n",
+			       corpus_names[i], len, windows[j], looks[k], modes[m].name,
+			       res.compressed_size ? (double)len / res.compressed_size : 0,
+			       res.status == RUN_OK ? mb / res.compress_time : 0,
+			       res.status == RUN_OK ? mb / res.decompress_time : 0,
+			       res.peak_rss, status_names[res.status]);
+			if(csv != NULL){
+				fprintf(csv, "%s,%zu,%d,%d,%s,%ld,%.4f,%.3f,%.3f,%ld,%s\n",
+					corpus_names[i], len, windows[j], looks[k], modes[m].name, res.compressed_size,
+					res.compressed_size ? (double)len / res.compressed_size : 0,
+					res.status == RUN_OK ? mb / res.compress_time : 0,
+					res.status == RUN_OK ? mb / res.decompress_time : 0,
+					res.peak_rss, status_names[res.status]);
+				fflush(csv);
+			}
+		}
+	}
+
+	remove(input);
+	remove(compressed);
+	remove(output);
+	if(csv != NULL && csv != stdout)
+		fclose(csv);
+
+	return failures ? 2 : 0;
+}
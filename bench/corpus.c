@@ -0,0 +1,252 @@
+/**
+ * @file corpus.c
+ *
+ * Synthetic corpora for the benchmarks, see corpus.h.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "corpus.h"
+#include "../include/dictionary.h"
+
+#define SEED 0x1984
+
+const char *corpus_names[] = {
+	"text", "logs", "json", "binary", "random", "zeros",
+	"dict-it", "dict-en", "dict-cc", NULL
+};
+
+/**
+ * Output buffer used by the generators, append() stops to write when the
+ * buffer is full.
+ */
+struct out{
+	unsigned char *buf;
+	size_t len;
+	size_t size;
+};
+
+static void append(struct out *o, const char *data, size_t n)
+{
+	if(n > o->size - o->len)
+		n = o->size - o->len;
+	memcpy(o->buf + o->len, data, n);
+	o->len += n;
+}
+
+static int full(const struct out *o)
+{
+	return o->len == o->size;
+}
+
+uint64_t corpus_random(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * Pick a number in [0, n) where the small numbers are more frequent, it
+ * gives a word distribution similar to the natural languages.
+ */
+static int skewed(uint64_t *state, int n)
+{
+	double r = (double)(corpus_random(state) >> 11) / (double)(1ULL << 53);
+
+	return (int)(r * r * r * n);
+}
+
+
+/* word list taken from the "en" dictionary */
+static const char *words[4096];
+static int words_len[4096];
+static int n_words;
+
+static void load_words(void)
+{
+	const struct dictionary *dict = find_dictionary("en");
+	int i, start = -1;
+
+	if(n_words > 0 || dict == NULL)
+		return;
+
+	for(i = 0; i <= dict->length && n_words < 4096; i++){
+		int letter = i < dict->length &&
+			((dict->data[i] >= 'a' && dict->data[i] <= 'z') || (dict->data[i] >= 'A' && dict->data[i] <= 'Z'));
+
+		if(letter && start == -1)
+			start = i;
+		if(!letter && start != -1){
+			words[n_words] = (const char*)dict->data + start;
+			words_len[n_words] = i - start;
+			n_words++;
+			start = -1;
+		}
+	}
+}
+
+static void gen_text(struct out *o, uint64_t *state)
+{
+	while(!full(o)){
+		int w = skewed(state, n_words);
+
+		append(o, words[w], words_len[w]);
+		if(corpus_random(state) % 12 == 0)
+			append(o, corpus_random(state) % 3 ? ". " : ",\n", 2);
+		else
+			append(o, " ", 1);
+	}
+}
+
+static void gen_logs(struct out *o, uint64_t *state)
+{
+	static const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+	static const char *services[] = { "api", "auth", "db", "cache", "worker" };
+	char line[256];
+	long ms = 0;
+	int n;
+
+	while(!full(o)){
+		ms += corpus_random(state) % 1500;
+		n = snprintf(line, sizeof(line),
+			"2024-03-%02ld %02ld:%02ld:%02ld.%03ld host-%02d %s[%d]: %s request id=%08x user=%d latency=%dms status=%d path=/%s/%s\n",
+			1 + ms / 86400000 % 28, ms / 3600000 % 24, ms / 60000 % 60, ms / 1000 % 60, ms % 1000,
+			(int)(corpus_random(state) % 16), services[ corpus_random(state) % 5 ], 1000 + (int)(corpus_random(state) % 50),
+			levels[ corpus_random(state) % 6 ], (unsigned int)corpus_random(state), skewed(state, 10000),
+			(int)(corpus_random(state) % 900), corpus_random(state) % 10 ? 200 : 500,
+			services[ corpus_random(state) % 5 ], words[ skewed(state, n_words) ]);
+		append(o, line, n);
+	}
+}
+
+static void gen_json(struct out *o, uint64_t *state)
+{
+	char record[512];
+	int id = 0, n, w;
+
+	append(o, "[\n", 2);
+	while(!full(o)){
+		w = skewed(state, n_words);
+		n = snprintf(record, sizeof(record),
+			"  {\"id\": %d, \"name\": \"%.*s_%d\", \"email\": \"%.*s%d@example.com\", \"active\": %s, "
+			"\"score\": %d.%02d, \"tags\": [\"%.*s\", \"%.*s\"]},\n",
+			id, words_len[w], words[w], skewed(state, 1000), words_len[w], words[w], (int)(corpus_random(state) % 100),
+			corpus_random(state) % 4 ? "true" : "false", (int)(corpus_random(state) % 100), (int)(corpus_random(state) % 100),
+			words_len[id % n_words], words[id % n_words], words_len[(id * 7) % n_words], words[(id * 7) % n_words]);
+		append(o, record, n);
+		id++;
+	}
+}
+
+static void gen_binary(struct out *o, uint64_t *state)
+{
+	unsigned char record[32];
+	uint32_t counter = 0;
+	int i;
+
+	while(!full(o)){
+		memset(record, 0, sizeof(record));
+		// little endian counter, small numbers and few random bytes
+		for(i = 0; i < 4; i++)
+			record[i] = (counter >> (8*i)) & 0xff;
+		record[4] = corpus_random(state) % 4;
+		record[6] = skewed(state, 256);
+		record[8] = 0x3f;
+		record[9] = 0x80 | (corpus_random(state) % 8);
+		for(i = 16; i < 20; i++)
+			record[i] = corpus_random(state);
+		record[24] = 0xff;
+		record[25] = 0xff;
+		counter++;
+		append(o, (char*)record, sizeof(record));
+	}
+}
+
+static void gen_random(struct out *o, uint64_t *state)
+{
+	uint64_t r;
+
+	while(!full(o)){
+		r = corpus_random(state);
+		append(o, (char*)&r, sizeof(r));
+	}
+}
+
+static void gen_zeros(struct out *o, uint64_t *state)
+{
+	static const char zeros[4096];
+	char noise[64];
+	int i;
+
+	while(!full(o)){
+		append(o, zeros, 1024 + corpus_random(state) % 3072);
+		for(i = 0; i < (int)sizeof(noise); i++)
+			noise[i] = corpus_random(state);
+		append(o, noise, 16 + corpus_random(state) % 48);
+	}
+}
+
+
+unsigned char* corpus_generate(const char *name, size_t size, size_t *len)
+{
+	struct out o;
+	uint64_t state = SEED;
+
+	if(name == NULL || len == NULL){
+		errno = EINVAL;
+		return NULL;
+	}
+
+	// the dictionaries are used as they are
+	if(strncmp(name, "dict-", 5) == 0){
+		const struct dictionary *dict = find_dictionary(name + 5);
+
+		if(dict == NULL)
+			return NULL;
+		if(size > (size_t)dict->length)
+			size = dict->length;
+		o.buf = malloc(size);
+		if(o.buf == NULL)
+			return NULL;
+		memcpy(o.buf, dict->data, size);
+		*len = size;
+		return o.buf;
+	}
+
+	o.buf = malloc(size);
+	if(o.buf == NULL)
+		return NULL;
+	o.len = 0;
+	o.size = size;
+	load_words();
+
+	if(strcmp(name, "text") == 0)
+		gen_text(&o, &state);
+	else if(strcmp(name, "logs") == 0)
+		gen_logs(&o, &state);
+	else if(strcmp(name, "json") == 0)
+		gen_json(&o, &state);
+	else if(strcmp(name, "binary") == 0)
+		gen_binary(&o, &state);
+	else if(strcmp(name, "random") == 0)
+		gen_random(&o, &state);
+	else if(strcmp(name, "zeros") == 0)
+		gen_zeros(&o, &state);
+	else{
+		free(o.buf);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	*len = o.len;
+	return o.buf;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file corpus.h
+ *
+ * Deterministic generator of the synthetic corpora used by the benchmarks.
+ * The same name and size give always the same bytes, so the results of
+ * different runs (and different versions of the software) can be compared.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#ifndef _CORPUS_H_
+#define _CORPUS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Names of the available corpora, the list is terminated by NULL.
+ *  - text	: words of the "en" dictionary with punctuation
+ *  - logs	: lines of a service log with timestamps and key=value pairs
+ *  - json	: array of JSON records
+ *  - binary	: array of fixed size records with counters and small numbers
+ *  - random	: random bytes, they can't be compressed
+ *  - zeros	: long runs of zeros with short random segments
+ *  - dict-it, dict-en, dict-cc : the dictionaries compiled in the software
+ */
+extern const char *corpus_names[];
+
+/**
+ * Generate a corpus.
+ *
+ * @param name	name of the corpus (see corpus_names)
+ * @param size	number of bytes to generate, the dictionaries are never
+ *		longer than their own length
+ * @param len	where to store the number of bytes generated
+ *
+ * @return	buffer (to free with free()) with the data
+ *		NULL if the name isn't correct or there isn't memory, and errno is set.
+ */
+unsigned char* corpus_generate(const char *name, size_t size, size_t *len);
+
+/**
+ * Pseudo random generator (xorshift64*) used for the corpora, the state
+ * must be different from zero.
+ */
+uint64_t corpus_random(uint64_t *state);
+
+#endif
@@ -0,0 +1,455 @@
+/**
+ * @file micro.c
+ *
+ * Microbenchmarks of the hot paths of the compressor (lz77-micro):
+ *  - bit_write() and bit_read() with different field widths
+ *  - add_node() and delete_node() with adversarial inputs
+ *    (sorted, all zeros, random, text)
+ *  - latency distribution of find_match()
+ *  - encode()/decode() against encode_context()/decode_context() on small
+ *    files, the cost of the allocations and of the setup
+ * The process is pinned to one CPU (-p) and each measure is repeated -r
+ * times, the minimum and the median are reported.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include "corpus.h"
+#include "../include/tree.h"
+#include "../include/bitio.h"
+#include "../include/lz77.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <x86intrin.h>
+	#define TICKS_UNIT "cycles"
+#else
+	#define TICKS_UNIT "ns"
+#endif
+
+#define MAX_REPS 64
+
+static int reps = 5;
+static int window_length = 1024;
+static int look_ah_length = 16;
+
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Fine grained timer used for the latency of a single call, it's the time
+ * stamp counter on x86 and nanoseconds elsewhere.
+ */
+static inline uint64_t ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Print min and median of the times (seconds) of the repetitions as
+ * nanoseconds per operation.
+ */
+static void report(const char *name, double *times, int n, long ops)
+{
+	qsort(times, n, sizeof(double), cmp_double);
+	printf("%-36s %10.2f %10.2f ns/op\n", name, times[0] * 1e9 / ops, times[n/2] * 1e9 / ops);
+}
+
+
+/* bitio */
+
+static void bench_bitio(const char *tmp)
+{
+	static const int widths[] = { 1, 4, 8, 9, 12, 16, 24, 32 };
+	const long n_fields = 1 << 20;
+	double w_times[MAX_REPS], r_times[MAX_REPS];
+	double p_times[MAX_REPS], k_times[MAX_REPS];
+	char name[64];
+	uint64_t bits;
+	uint32_t value, sink = 0;
+	int i, r;
+	long j;
+
+	for(i = 0; i < (int)(sizeof(widths)/sizeof(widths[0])); i++){
+		for(r = 0; r < reps; r++){
+			struct bitfile *fd;
+			double start;
+
+			remove(tmp);
+			fd = bit_open(tmp, BIT_WR, 8 * MAX_SIZE);
+			if(fd == NULL){
+				perror(tmp);
+				exit(1);
+			}
+			start = now();
+			for(j = 0; j < n_fields; j++){
+				value = (uint32_t)j * 2654435761u;
+				bit_write(fd, (char*)&value, widths[i], 0);
+			}
+			bit_close(fd);
+			w_times[r] = now() - start;
+
+			fd = bit_open(tmp, BIT_RD, 8 * MAX_SIZE);
+			start = now();
+			for(j = 0; j < n_fields; j++){
+				value = 0;
+				bit_read(fd, (char*)&value, widths[i], 0);
+				sink += value;
+			}
+			r_times[r] = now() - start;
+			bit_close(fd);
+
+			// the fast paths: a store and a load of 64 bits for each field
+			remove(tmp);
+			fd = bit_open(tmp, BIT_WR, 8 * MAX_SIZE);
+			start = now();
+			for(j = 0; j < n_fields; j++)
+				bit_put(fd, (uint32_t)j * 2654435761u, widths[i]);
+			bit_close(fd);
+			p_times[r] = now() - start;
+
+			fd = bit_open(tmp, BIT_RD, 8 * MAX_SIZE);
+			start = now();
+			for(j = 0; j < n_fields; j++){
+				bit_peek(fd, &bits);
+				bit_skip(fd, widths[i]);
+				sink += bits & (((uint64_t)1 << widths[i]) - 1);
+			}
+			k_times[r] = now() - start;
+			bit_close(fd);
+		}
+		snprintf(name, sizeof(name), "bit_write %2d bits", widths[i]);
+		report(name, w_times, reps, n_fields);
+		snprintf(name, sizeof(name), "bit_read  %2d bits", widths[i]);
+		report(name, r_times, reps, n_fields);
+		snprintf(name, sizeof(name), "bit_put   %2d bits", widths[i]);
+		report(name, p_times, reps, n_fields);
+		snprintf(name, sizeof(name), "bit_peek  %2d bits", widths[i]);
+		report(name, k_times, reps, n_fields);
+	}
+	remove(tmp);
+	if(sink == 1)	// keep the reads
+		printf("\n");
+}
+
+
+/* tree */
+
+/**
+ * Fill the window (2 * window_length bytes) with the input called kind.
+ */
+static void fill_window(unsigned char *buf, const char *kind)
+{
+	int n = window_length * K;
+	uint64_t state = 0x1984;
+	int i;
+
+	if(strcmp(kind, "sorted") == 0){
+		for(i = 0; i < n; i++)
+			buf[i] = i * 256 / n;
+	}else if(strcmp(kind, "zeros") == 0){
+		memset(buf, 0, n);
+	}else if(strcmp(kind, "random") == 0){
+		for(i = 0; i < n; i++)
+			buf[i] = corpus_random(&state);
+	}else{ // text
+		size_t len;
+		unsigned char *text = corpus_generate("text", n, &len);
+
+		memcpy(buf, text, len);
+		free(text);
+	}
+}
+
+static void init_window(struct window *w, unsigned char *buf)
+{
+	memset(w, 0, sizeof(*w));
+	w->window_length = window_length;
+	w->look_ah_length = look_ah_length;
+	w->dict_position = 0;
+	w->data_position = window_length;
+	w->window = buf;
+}
+
+static void bench_tree(void)
+{
+	static const char *kinds[] = { "sorted", "zeros", "random", "text" };
+	double add_times[MAX_REPS], slide_times[MAX_REPS];
+	unsigned char *buf = calloc(window_length * K + KEY_BYTES, 1);
+	struct tree *tree = build_tree(window_length);
+	struct window w;
+	char name[64];
+	int i, r, j;
+
+	for(i = 0; i < 4; i++){
+		fill_window(buf, kinds[i]);
+		for(r = 0; r < reps; r++){
+			double start;
+
+			init_window(&w, buf);
+			empty_tree(tree);
+
+			// build the tree of the dictionary like encode() does
+			start = now();
+			for(j = 0; j < window_length; j++)
+				add_node(tree, j, &w);
+			add_times[r] = now() - start;
+
+			// slide the window: delete the oldest string and add a new one
+			start = now();
+			for(j = 0; j < window_length - look_ah_length; j++){
+				delete_node(tree, w.dict_position);
+				w.dict_position++;
+				add_node(tree, w.data_position, &w);
+				w.data_position++;
+			}
+			slide_times[r] = now() - start;
+		}
+		snprintf(name, sizeof(name), "add_node %s", kinds[i]);
+		report(name, add_times, reps, window_length);
+		snprintf(name, sizeof(name), "delete_node+add_node %s", kinds[i]);
+		report(name, slide_times, reps, window_length - look_ah_length);
+	}
+
+	free_tree(tree);
+	free(buf);
+}
+
+
+/* find_match */
+
+static void bench_find_match(void)
+{
+	static const char *kinds[] = { "text", "random", "sorted", "zeros" };
+	int n = window_length - look_ah_length;
+	uint64_t *lat = malloc(sizeof(uint64_t) * n * reps);
+	unsigned char *buf = calloc(window_length * K + KEY_BYTES, 1);
+	struct tree *tree = build_tree(window_length);
+	struct window w;
+	struct match m;
+	long total_len;
+	int i, r, j, k;
+
+	for(i = 0; i < 4; i++){
+		fill_window(buf, kinds[i]);
+		k = 0;
+		total_len = 0;
+		for(r = 0; r < reps; r++){
+			init_window(&w, buf);
+			empty_tree(tree);
+			for(j = 0; j < window_length; j++)
+				add_node(tree, j, &w);
+
+			// one find_match() for each position, only the search is measured
+			for(j = 0; j < n; j++){
+				uint64_t start = ticks();
+
+				m = find_match(tree, w);
+				lat[k++] = ticks() - start;
+				total_len += m.len;
+
+				delete_node(tree, w.dict_position);
+				w.dict_position++;
+				add_node(tree, w.data_position, &w);
+				w.data_position++;
+			}
+		}
+		qsort(lat, k, sizeof(uint64_t), cmp_u64);
+		printf("find_match %-8s %s: p50 %llu p90 %llu p99 %llu max %llu (avg len %.1f)\n",
+		       kinds[i], TICKS_UNIT, (unsigned long long)lat[k/2], (unsigned long long)lat[k*9/10],
+		       (unsigned long long)lat[k*99/100], (unsigned long long)lat[k-1], (double)total_len / k);
+	}
+
+	free(lat);
+	free_tree(tree);
+	free(buf);
+}
+
+
+/* contexts */
+
+#define SMALL_FILE 4096
+#define SMALL_FILES 500
+
+static void bench_context(const char *tmp)
+{
+	double times[4][MAX_REPS];
+	char in[4200], out[4200], back[4200];
+	struct options opt;
+	struct lz77_context *enc, *dec;
+	unsigned char *text;
+	size_t len;
+	FILE *f;
+	int r, j, null_fd, stdout_fd;
+
+	snprintf(in, sizeof(in), "%s.in", tmp);
+	snprintf(out, sizeof(out), "%s.lz", tmp);
+	snprintf(back, sizeof(back), "%s.out", tmp);
+	text = corpus_generate("text", SMALL_FILE, &len);
+	f = fopen(in, "w");
+	if(f == NULL || fwrite(text, 1, len, f) != len){
+		perror(in);
+		exit(1);
+	}
+	fclose(f);
+	free(text);
+
+	init_opt(&opt);
+	opt.window_len = window_length;
+	opt.look_ahead_len = look_ah_length;
+	enc = lz77_context_create(COMPRESSION, window_length);
+	dec = lz77_context_create(DECOMPRESSION, MAX_WINDOW_LEN);
+
+	// encode() and decode() print the options
+	fflush(stdout);
+	stdout_fd = dup(STDOUT_FILENO);
+	null_fd = open("/dev/null", O_WRONLY);
+	dup2(null_fd, STDOUT_FILENO);
+
+	for(r = 0; r < reps; r++){
+		double start;
+
+		opt.mode = COMPRESSION;
+		opt.file_in = in;
+		opt.file_out = out;
+		start = now();
+		for(j = 0; j < SMALL_FILES; j++)
+			encode(opt);
+		times[0][r] = now() - start;
+		start = now();
+		for(j = 0; j < SMALL_FILES; j++)
+			encode_context(enc, opt);
+		times[1][r] = now() - start;
+
+		opt.mode = DECOMPRESSION;
+		opt.file_in = out;
+		opt.file_out = back;
+		start = now();
+		for(j = 0; j < SMALL_FILES; j++)
+			decode(opt);
+		times[2][r] = now() - start;
+		start = now();
+		for(j = 0; j < SMALL_FILES; j++)
+			decode_context(dec, opt);
+		times[3][r] = now() - start;
+	}
+
+	fflush(stdout);
+	dup2(stdout_fd, STDOUT_FILENO);
+	close(stdout_fd);
+	close(null_fd);
+
+	report("encode 4 KiB", times[0], reps, SMALL_FILES);
+	report("encode_context 4 KiB", times[1], reps, SMALL_FILES);
+	report("decode 4 KiB", times[2], reps, SMALL_FILES);
+	report("decode_context 4 KiB", times[3], reps, SMALL_FILES);
+
+	lz77_context_free(enc);
+	lz77_context_free(dec);
+	remove(in);
+	remove(out);
+	remove(back);
+}
+
+
+int main(int argc, char *argv[])
+{
+	char tmp[4096];
+	char *only = NULL;
+	int cpu = 0;
+	int c;
+	cpu_set_t set;
+
+	while((c = getopt(argc, argv, "hp:r:w:l:b:")) != -1){
+		switch(c){
+			case 'p':
+				cpu = atoi(optarg);
+				break;
+			case 'r':
+				reps = atoi(optarg);
+				break;
+			case 'w':
+				window_length = atoi(optarg);
+				break;
+			case 'l':
+				look_ah_length = atoi(optarg);
+				break;
+			case 'b':
+				only = optarg;
+				break;
+			default:
+				printf("Usage: ./lz77-micro [options]\n\n");
+				printf("options \n");
+				printf("  -p CPU\tPin the process on this CPU (default 0), -1 to not pin it\n");
+				printf("  -r N\tRepetitions (default 5, max %d)\n", MAX_REPS);
+				printf("  -w VALUE\tWindow length for the tree benchmarks (default 1024)\n");
+				printf("  -l VALUE\tLook ahead length for the tree benchmarks (default 16)\n");
+				printf("  -b NAME\tRun only a benchmark: bitio, tree, find_match or context\n");
+				return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if(reps <= 0 || reps > MAX_REPS || look_ah_length < 1 || look_ah_length > 255 ||
+	   window_length < look_ah_length || window_length > 32767){
+		printf("Error : wrong parameters, use -h to see how to use this program.\n");
+		return 1;
+	}
+
+	if(cpu >= 0){
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if(sched_setaffinity(0, sizeof(set), &set) == -1)
+			perror("sched_setaffinity");
+	}
+
+	printf("window %d, look ahead %d, %d repetitions, cpu %d\n", window_length, look_ah_length, reps, cpu);
+	printf("%-36s %10s %10s\n", "", "min", "median");
+
+	if(only == NULL || strcmp(only, "bitio") == 0){
+		snprintf(tmp, sizeof(tmp), "/tmp/lz77-micro-%d", (int)getpid());
+		bench_bitio(tmp);
+	}
+	if(only == NULL || strcmp(only, "tree") == 0)
+		bench_tree();
+	if(only == NULL || strcmp(only, "find_match") == 0)
+		bench_find_match();
+	if(only == NULL || strcmp(only, "context") == 0){
+		snprintf(tmp, sizeof(tmp), "/tmp/lz77-micro-%d", (int)getpid());
+		bench_context(tmp);
+	}
+
+	return 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file archive.h
+ *
+ * Solid archives (--solid): many files compressed through the same sliding
+ * window, as if they were a single file (the content), so a file can be
+ * encoded with matches in the files before it. Small files compress much
+ * better than one at a time because they don't restart from the dictionary.
+ *
+ * To extract a file without decompressing all the ones before it the
+ * content is cut in pieces of --restart bytes (restart points), each one
+ * is an independent compressed stream (see encode_stream()): the extraction
+ * decodes from the nearest restart point before the file.
+ *
+ * Format, the numbers are in network order (big endian)
+ *
+ *	| ARCHIVE HEADER | STREAM 0 | STREAM 1 | ... | TABLE | TRAILER |
+ *
+ *  - ARCHIVE HEADER	magic "LZ7A" (4 bytes), version (1 byte), 3 bytes at zero
+ *  - STREAM i		the content from restart point i to restart point i+1,
+ *			it's a complete compressed stream (header, tokens, eof)
+ *			and starts at a byte boundary
+ *  - TABLE		number of restart points (4 bytes), for each one the offset
+ *			of its stream in the archive (8 bytes) and of its data in
+ *			the content (8 bytes).
+ *			Number of files (4 bytes), for each one its offset in the
+ *			content (8 bytes), its size (8 bytes), the length of its
+ *			name (2 bytes) and the name (without the final '\0').
+ *  - TRAILER		offset of the table in the archive (8 bytes), magic "LZ7T"
+ *			(4 bytes)
+ *
+ * The table is at the end so the archive is written in a single pass.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#ifndef _ARCHIVE_H_
+#define _ARCHIVE_H_
+
+#include "option.h"
+
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_RESTART 1048576	// default distance between the restart points (bytes)
+
+/**
+ * Compress a list of files in the solid archive opt.file_out.
+ *
+ * @param opt		options, opt.restart is the distance between the restart
+ *			points (0 means only one at the start)
+ * @param files		names of the files, they are stored as they are
+ * @param n_files	number of files, if it's 0 the names are read from the
+ *			standard input, one for each line
+ *
+ * @return		0 if success, -1 otherwise and the archive is removed
+ */
+int archive_create(struct options opt, char **files, int n_files);
+
+/**
+ * Extract the files of the solid archive opt.file_in.
+ *  - opt.extract NULL	all the files are extracted with their names, the
+ *			directories are created, the files that already exist
+ *			aren't overwritten
+ *  - opt.extract NAME	only the file NAME is extracted in opt.file_out (the
+ *			standard output if it's NULL), starting from the
+ *			nearest restart point
+ * In test mode the archive is only checked, with verbose the list of the
+ * files is printed.
+ *
+ * @return		0 if success, -1 otherwise
+ */
+int archive_extract(struct options opt);
+
+#endif
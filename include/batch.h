@@ -0,0 +1,50 @@
+/**
+ * @file batch.h
+ *
+ * Batch mode (--batch): many files compressed, decompressed or tested by a
+ * single process, so the process start and the dictionary load are paid
+ * once and not for each file.
+ * The files are shared by a pool of worker threads, each one takes the next
+ * file of the list and runs encode_context() or decode_context() with a
+ * context taken from a pool (see context.h). In compression the dictionary
+ * is loaded and inserted in the tree only once (see encode_preload()), the
+ * workers copy it in their contexts.
+ * At the end the totals and the throughput of the whole batch are printed.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include "option.h"
+
+#define BATCH_SUFFIX ".lz77"	// added to the name of the compressed files
+
+/**
+ * Compress, decompress or test (opt.mode) a list of files.
+ * The output of FILE is FILE.lz77 in compression and FILE.lz77 gives FILE
+ * in decompression. An output that already exists isn't overwritten, the
+ * file is counted as an error. An error in a file doesn't stop the others.
+ *
+ * @param opt		options, file_in and file_out aren't used
+ * @param files		names of the files
+ * @param n_files	number of files, if it's 0 the names are read from the
+ *			standard input, one for each line
+ *
+ * @return		0 if all the files are done, -1 otherwise
+ */
+int batch(struct options opt, char **files, int n_files);
+
+/**
+ * Read the names of the files from the standard input, one for each line
+ * (the empty lines are skipped).
+ *
+ * @param files		where to store the array of the names, the array and
+ *			each name must be freed
+ *
+ * @return		the number of files, -1 in case of error
+ */
+int batch_read_list(char ***files);
+
+#endif
@@ -18,7 +18,7 @@
 
 #define BIT_WR 1
 #define BIT_RD 0
-#define MAX_SIZE 1024	//bytes
+#define MAX_SIZE 65536	//bytes, a read or a write of a pipe moves up to a buffer
 #define MIN_SIZE 4	//bytes
 
 
@@ -28,6 +28,12 @@
  */
 struct bitfile;
 
+/**
+ * Function used by a bitfile instead of read() or write() (see bit_open_io_at()),
+ * it has the same interface: arg is given to bit_open_io_at().
+ */
+typedef int (*bit_io)(void *arg, char *buf, int n);
+
 
 
 /**
@@ -47,6 +53,45 @@ struct bitfile;
  */
 struct bitfile* bit_open(const char *filename, int mode, int bufsize );
 
+/**
+ * @brief Like bit_open() but the bitfile structure is stored in mem instead of
+ * allocated, bit_close() doesn't free it.
+ *
+ * @param mem		memory for the structure, at least bit_size(bufsize) bytes
+ *
+ * @return 		BITFILE pointer (mem) if success.
+ *			NULL if some error occour, and errno is set appropriately.
+ */
+struct bitfile* bit_open_at(const char *filename, int mode, int bufsize, void *mem);
+
+/**
+ * @brief Like bit_open_at() but on a file already open, the data is read or
+ * written from its current offset. bit_close() doesn't close fd.
+ *
+ * @param fd		file descriptor opened for reading (BIT_RD) or writing (BIT_WR)
+ *
+ * @return 		BITFILE pointer (mem) if success.
+ *			NULL if some error occour, and errno is set appropriately.
+ */
+struct bitfile* bit_fdopen_at(int fd, int mode, int bufsize, void *mem);
+
+/**
+ * @brief Like bit_open_at() but the data is read or written by the function io
+ * instead of a file, bit_close() doesn't close anything.
+ *
+ * @param io		function that reads (BIT_RD) or writes (BIT_WR) the bytes
+ * @param arg		first argument of io
+ *
+ * @return 		BITFILE pointer (mem) if success.
+ *			NULL if some error occour, and errno is set appropriately.
+ */
+struct bitfile* bit_open_io_at(bit_io io, void *arg, int mode, int bufsize, void *mem);
+
+/**
+ * @brief Return the bytes needed by a bitfile with a buffer of bufsize bits.
+ */
+size_t bit_size(int bufsize);
+
 
 /**
  *  @brief  Read n bits from the buffer buf and put them in the buffer of bitfile structure
@@ -69,6 +114,41 @@ struct bitfile* bit_open(const char *filename, int mode, int bufsize );
 int bit_write(struct bitfile *fd, const char *buf, int n_bits, int ofs);
 
 
+/**
+ *  @brief Write the n least significant bits of bits, the least significant first.
+ *
+ *  Like bit_write() of a little endian integer but with a single store of 64
+ *  bits instead of a loop on the bits: the encoder packs all the fields of a
+ *  token in an integer and writes it with a call.
+ *
+ *  @param fd 		is a pointer to the bitfile structure
+ *  @param bits 	the bits to write
+ *  @param n	 	number of bits, at most 57
+ *
+ *  @return 	the number of the written bits
+ *		-1 if an error is occured, in that case set errno.
+ */
+int bit_put(struct bitfile *fd, uint64_t bits, int n);
+
+/**
+ * @brief Go to the start of the next byte: in write mode zeros are written, in
+ * read mode the bits are skipped. Nothing is done if the bits written or read
+ * until now are a multiple of 8.
+ *
+ * @return	the number of bits written or skipped,
+ *		-1 if an error is occured, in that case set errno.
+ */
+int bit_align(struct bitfile *fd);
+
+/**
+ * @brief Write n bytes with memcpy(), the bits written until now must be a
+ * multiple of 8.
+ *
+ * @return	n, -1 if an error is occured, in that case set errno.
+ */
+int bit_write_bytes(struct bitfile *fd, const char *buf, int n);
+
+
 /**
  *  @brief Read n bits from the file descriptor fd and store them into the buffer.
  *
@@ -90,6 +170,44 @@ int bit_write(struct bitfile *fd, const char *buf, int n_bits, int ofs);
 int bit_read(struct bitfile *fd, char *buf, int n_bits, int ofs);
 
 
+/**
+ * @brief Return the next bits of the file without consuming them.
+ *
+ * The first bit of the file is the least significant bit of *bits, like a
+ * field read by bit_read() in a little endian integer. It's the fast path of
+ * the decoder: the tokens are taken from *bits and consumed together with
+ * bit_skip(). It can be mixed with bit_read().
+ *
+ * @param fd 	is a pointer to the bitfile structure (source)
+ * @param bits	where to store the bits
+ *
+ * @return	the number of valid bits in *bits, at least 57 if the file has
+ *		them, 0 at the end of the file,
+ *		-1 if an error is occured, in that case set errno.
+ */
+int bit_peek(struct bitfile *fd, uint64_t *bits);
+
+/**
+ * @brief Consume n bits, at most the ones returned by the last bit_peek().
+ */
+void bit_skip(struct bitfile *fd, int n);
+
+/**
+ * @brief Byte aligned reading without copies: *p points to the next bytes of
+ * the buffer, they are consumed with bit_skip() (8 bits for each byte).
+ * It fills the buffer if it has less than min bytes. It can be used only
+ * when the bits read until now are a multiple of 8.
+ *
+ * @param fd 	is a pointer to the bitfile structure (source)
+ * @param p	where to store the pointer to the bytes
+ * @param min	bytes needed, at most the size of the buffer
+ *
+ * @return	the number of bytes at *p, less than min only at the end of
+ *		the file, -1 if an error is occured, in that case set errno.
+ */
+int bit_bytes(struct bitfile *fd, const unsigned char **p, int min);
+
+
 /**
  * @brief Force a write operation to the file specified in the BITFILE structure. 
  * 
@@ -115,7 +233,8 @@ int bit_flush(struct bitfile *fd);
  *
  * ERRORS
  *	EINVAL		if some function's arguments isn't correct.
- *	Others		are all the possible error returned by close() function.
+ *	Others		are all the possible error returned by bit_flush() and close().
+ *			The structure is released also in case of error.
  */
 int bit_close(struct bitfile *fp);
 
@@ -0,0 +1,31 @@
+/**
+ * @file checksum.h
+ *
+ * This file contains the function used to compute the checksum of the data
+ * stored in the compressed file. The checksum is the CRC32C (Castagnoli
+ * polynomial), on processors with SSE4.2 it's computed by the crc32
+ * instruction otherwise it's used a table driven implementation.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Update the CRC32C crc with len bytes of buf.
+ * To compute the checksum of some data split in more buffers use 0 as
+ * crc for the first buffer and the returned value for the next ones.
+ *
+ * @param crc	checksum of the previous data, 0 at the beginning
+ * @param buf	data
+ * @param len	number of bytes in buf
+ *
+ * @return	the updated checksum
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+#endif
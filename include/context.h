@@ -0,0 +1,139 @@
+/**
+ * @file context.h
+ *
+ * Contexts to compress or decompress many inputs without allocating memory
+ * for each of them.
+ * A context has all the memory used by encode_context() or decode_context()
+ * (window, tree, bitfile) taken from a single block (arena), it's allocated
+ * once and reset at the start of each input.
+ * A pool keeps the contexts not in use so that the threads can take and give
+ * back them: when the pool has enough contexts getting one doesn't allocate.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include <pthread.h>
+#include "window.h"
+#include "tree.h"
+
+#define CONTEXT_BUFSIZE (8 * 65536)	// bits of the bitfile buffer (see bit_open())
+
+struct lz77_preload;
+
+/**
+ * Memory used by the compression or the decompression of an input.
+ *  - mode		COMPRESSION or DECOMPRESSION (it has not the tree)
+ *  - window_len	max window length of the inputs
+ *  - arena		the memory block, all the other pointers are in it
+ *  - window		window array (window_len * K bytes plus KEY_BYTES)
+ *  - tree		the nodes are in the arena (only in compression)
+ *  - bitfile		memory for the bitfile of the compressed file
+ *  - preload		dictionary already in the window and in the tree, NULL
+ *			if encode_context() must load it (only in compression)
+ *  - next		next context in the pool
+ */
+struct lz77_context{
+	int mode;
+	int window_len;
+	char *arena;
+	size_t arena_size;
+	unsigned char *window;
+	struct tree tree;
+	void *bitfile;
+	const struct lz77_preload *preload;
+	struct lz77_context *next;
+};
+
+/**
+ * State of a compression context after the dictionary is loaded in the window
+ * and inserted in the tree, it depends only on the options below.
+ * It's built once (see encode_preload()) and copied in the contexts by
+ * encode_context(): the copy is much faster than the insertion of
+ * window_len strings. It's only read so many threads can share it.
+ */
+struct lz77_preload{
+	const struct dictionary *dict;
+	int window_len;
+	int look_ahead_len;
+	int max_depth;
+	struct lz77_context *ctx;	// window and tree with the dictionary
+};
+
+/**
+ * Pool of contexts with the same mode and window length, it can be used
+ * by more threads at the same time.
+ */
+struct lz77_pool{
+	pthread_mutex_t lock;
+	int mode;
+	int window_len;
+	struct lz77_context *free;	// contexts not in use
+	int created;
+};
+
+/**
+ * Allocate a context.
+ *
+ * @param mode		COMPRESSION or DECOMPRESSION
+ * @param window_len	max window length of the inputs, in decompression the
+ *			window length is read from the file so use MAX_WINDOW_LEN
+ *			if it isn't known
+ *
+ * @return		the context or NULL in case of error, and set errno
+ *
+ * ERRORS
+ *	EINVAL		if some function's arguments isn't correct.
+ *	Others		are all the possible error returned by malloc() function.
+ */
+struct lz77_context *lz77_context_create(int mode, int window_len);
+
+/**
+ * Prepare the context for a new input, encode_context() and decode_context()
+ * call it so it's needed only to clear the data of the previous input.
+ */
+void lz77_context_reset(struct lz77_context *ctx);
+
+/**
+ * Free the memory of a context.
+ */
+void lz77_context_free(struct lz77_context *ctx);
+
+/**
+ * Free a preload built by encode_preload().
+ */
+void lz77_preload_free(struct lz77_preload *preload);
+
+/**
+ * Initialize a pool.
+ *
+ * @param pool		the pool
+ * @param mode		COMPRESSION or DECOMPRESSION
+ * @param window_len	window length of the contexts
+ * @param n		contexts allocated now
+ *
+ * @return		0 success and -1 in case of error, and set errno
+ */
+int lz77_pool_init(struct lz77_pool *pool, int mode, int window_len, int n);
+
+/**
+ * Take a context from the pool, a new one is allocated only if all the
+ * contexts are in use.
+ *
+ * @return		the context or NULL in case of error, and set errno
+ */
+struct lz77_context *lz77_pool_get(struct lz77_pool *pool);
+
+/**
+ * Give back to the pool a context taken with lz77_pool_get().
+ */
+void lz77_pool_put(struct lz77_pool *pool, struct lz77_context *ctx);
+
+/**
+ * Free all the contexts of the pool, they must be all given back.
+ */
+void lz77_pool_destroy(struct lz77_pool *pool);
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * @file dictionary.h
+ *
+ * This file contains the dictionaries compiled into the software and the
+ * functions used to find them.
+ * A dictionary is the text preloaded in the window before to start the
+ * compression/decompression, so the first bytes of the input can be
+ * encoded as matches too.
+ * Each dictionary has a short name (used by the -t option) and an ID that
+ * is the 32-bit hash of its content, the ID is stored in the header of the
+ * compressed file so the decoder can check that it has the same dictionary
+ * used by the encoder.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#ifndef _DICTIONARY_H_
+#define _DICTIONARY_H_
+
+#include <stdint.h>
+
+/**
+ * This structure describe a dictionary compiled into the software.
+ *  - name	: name used in command line, it's of 2 characters
+ *  - data	: the text of the dictionary
+ *  - length	: number of bytes of data
+ */
+struct dictionary{
+	const char *name;
+	const unsigned char *data;
+	int length;
+};
+
+/**
+ * Search a dictionary by name.
+ *
+ * @param name	name of the dictionary ( "it", "en", ... )
+ *
+ * @return	pointer to the dictionary
+ *		NULL if there isn't a dictionary with this name, and errno is set.
+ *
+ * ERRORS
+ *	EINVAL		if some function's arguments isn't correct.
+ *	ENOENT		if the dictionary doesn't exist.
+ */
+const struct dictionary* find_dictionary(const char *name);
+
+/**
+ * Search a dictionary by its ID (the value stored in the header).
+ *
+ * @param id	content ID of the dictionary, see dictionary_id()
+ *
+ * @return	pointer to the dictionary
+ *		NULL if there isn't a dictionary with this ID, and errno is set.
+ *
+ * ERRORS
+ *	ENOENT		if the dictionary doesn't exist.
+ */
+const struct dictionary* find_dictionary_by_id(uint32_t id);
+
+/**
+ * Return the content ID of a dictionary, it's the FNV-1a 32-bit hash of
+ * the dictionary data.
+ *
+ * @param dict	dictionary
+ *
+ * @return	the content ID
+ */
+uint32_t dictionary_id(const struct dictionary *dict);
+
+#endif
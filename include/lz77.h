@@ -11,6 +11,28 @@
 #include <string.h>
 #include <stdint.h>
 #include "window.h"
+#include "context.h"
+
+
+/**
+ * Where encode_stream() reads the data to compress.
+ * read() stores at most n bytes in buf and returns how many, less than n
+ * only at the end of the data, -1 in case of error.
+ */
+struct lz77_input{
+	int (*read)(void *arg, unsigned char *buf, int n);
+	void *arg;
+};
+
+/**
+ * Where decode_stream() writes the data decompressed.
+ * write() writes the n bytes of buf and returns 0, -1 in case of error.
+ * With write NULL the data is only checked (test mode).
+ */
+struct lz77_output{
+	int (*write)(void *arg, const unsigned char *buf, int n);
+	void *arg;
+};
 
 
 /**
@@ -25,6 +47,46 @@
  */
 int encode(struct options opt);
 
+/**
+ * Like encode() but all the memory is taken from a context, so it doesn't
+ * allocate. The context must be for compression with window length
+ * opt.window_len (see context.h).
+ *
+ * @param ctx	context
+ * @param opt	is a Options structure, for more informations see file options.h
+ *
+ * @return	0 if successfully work and -1 if something goes wrong.
+ */
+int encode_context(struct lz77_context *ctx, struct options opt);
+
+/**
+ * The core of encode_context(): compress all the data of in and write the
+ * compressed stream (header, tokens, eof code and checksums) in out.
+ * out isn't flushed or closed, so more streams can be written in a file.
+ *
+ * @param ctx	context for compression with window length opt.window_len
+ * @param opt	options, file_in and file_out aren't used
+ * @param in	data to compress
+ * @param out	bitfile opened for writing
+ * @param stats	counters to update, NULL if they aren't needed
+ *
+ * @return	0 if successfully work and -1 if something goes wrong.
+ */
+int encode_stream(struct lz77_context *ctx, struct options opt, struct lz77_input *in,
+		  struct bitfile *out, struct lz77_stats *stats);
+
+/**
+ * Load the dictionary in a window and insert it in a tree as encode() does,
+ * the result can be given to encode_context() (field preload of the context)
+ * for all the inputs compressed with the same options.
+ *
+ * @param opt	options used to compress (dictionary, window length, look ahead
+ *		length and max depth)
+ *
+ * @return	the preload or NULL in case of error, and set errno
+ */
+struct lz77_preload *encode_preload(struct options opt);
+
 /**
  * LZ77 Decode Algorithm Implementation
  *
@@ -34,6 +96,33 @@ int encode(struct options opt);
  */
 int decode(struct options opt);
 
+/**
+ * Like decode() but all the memory is taken from a context, so it doesn't
+ * allocate. The context must be for decompression with a window length
+ * greater or equal to the one of the compressed file (see context.h).
+ *
+ * @param ctx	context
+ * @param opt	is a Options structure, for more informations see file options.h
+ *
+ * @return	0 if successfully work and -1 if something goes wrong.
+ */
+int decode_context(struct lz77_context *ctx, struct options opt);
+
+/**
+ * The core of decode_context(): read a compressed stream (see encode_stream())
+ * from in, until its eof code, and write the data in out.
+ *
+ * @param ctx	context for decompression
+ * @param opt	options, only mode and quiet are used
+ * @param in	bitfile opened for reading at the start of the stream
+ * @param out	where to write the data (write NULL in test mode)
+ * @param stats	counters to update, NULL if they aren't needed
+ *
+ * @return	0 if successfully work and -1 if something goes wrong.
+ */
+int decode_stream(struct lz77_context *ctx, struct options opt, struct bitfile *in,
+		  struct lz77_output *out, struct lz77_stats *stats);
+
 
 #endif
 
@@ -5,11 +5,30 @@
  * [options]
  * -c			-> compression
  * -d			-> decompression
+ * -T			-> test, decompression without output, only checks the data
+ * -s			-> add checksums to the compressed data
+ * --fast-decode	-> byte aligned tokens, faster to decompress (see HEADER_BYTES in window.h)
+ * --no-literal-runs	-> a token for each literal, the file can be read by the older versions
+ * -S file		-> write the statistics in JSON format in file
+ * --trace file		-> write the timing of the phases in Chrome trace-event format in file
  * -v			-> verbose
  * -w number		-> window dimension in bytes
  * -l number		-> lookahead dimension in bytes
  * -i file_in		-> input file , if c mode is the original file , compress file otherwise.
  * -o file_out		-> output file,  if c mode is the compress file , original file otherwise.
+ * -t name		-> dictionary preloaded in the window
+ * --max-visits number	-> max tree nodes visited by a match search
+ * --nice-length number	-> a match search stops when it finds a match this long
+ * --max-depth number	-> strings deeper than this in the tree aren't inserted
+ * --batch		-> compress/decompress many files, listed after the options
+ *			   or on the standard input (see batch.h)
+ * --jobs number	-> worker threads of the batch mode
+ * --solid		-> solid archive of many files (see archive.h)
+ * --restart number	-> distance in bytes between the restart points of the archive
+ * --extract name	-> extract only this file from the archive
+ * --no-pipeline	-> read and write the files in the thread of the codec (see pipeline.h)
+ * --io-uring		-> the pipeline uses io_uring where it's available
+ * --auto speed		-> choose -w, -l, -t and the search limits sampling the input (see tune.h)
  *
  * @author Pischedda Alessandro
  */
@@ -24,10 +43,16 @@
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
+#include "dictionary.h"
 
 #define COMPRESSION 1
 #define DECOMPRESSION 0
 #define NONE 2
+#define TEST 3
+
+#define MAX_WINDOW_LEN 32767
+#define DEFAULT_WINDOW_LEN 1024
+#define DEFAULT_LOOK_AHEAD_LEN 64
 
 
 /**
@@ -36,11 +61,35 @@
 struct options{
 	char *file_in;
 	char *file_out;
-	int mode;	// must be COMPRESSION (1) or DECOMPRESSION (0)
+	int mode;	// must be COMPRESSION (1), DECOMPRESSION (0) or TEST (3)
 	int verbose;
+	int checksum;	// add the checksums in compression mode
+	int fast_decode;	// byte aligned tokens (HEADER_BYTES)
+	int literal_runs;	// literal run code in the bit format (HEADER_LITERAL_RUNS)
+	int block_widths;	// field widths of each block of tokens in the bit format (HEADER_BLOCK_WIDTHS)
+	char *stats_file;	// where write the statistics, NULL if not requested
+	char *trace_file;	// where write the trace, NULL if not requested
 	int window_len;
 	int look_ahead_len;
-	char *dict;
+	const struct dictionary *dict;
+	// search effort limits (see struct window), 0 means no limit
+	int max_visits;
+	int nice_len;
+	int max_depth;
+	// batch mode (see batch.h)
+	int batch;
+	int jobs;	// worker threads, 0 means one for each CPU
+	// solid archive (see archive.h)
+	int solid;
+	uint64_t restart;	// bytes between the restart points, 0 means only one
+	char *extract;	// file to extract, NULL means all
+	int quiet;	// the options aren't printed, it's set by batch and archive
+	int exclusive;	// the output is created only if it doesn't exist (O_EXCL), it's set by batch
+	int pipeline;	// reader and writer threads around the codec (see pipeline.h)
+	int io_uring;	// the pipeline uses io_uring (PIPELINE_URING)
+	int stdout_fd;	// descriptor of the data for the standard output (see messages_to_stderr())
+	int tune;	// the parameters are chosen by tune_options() (see tune.h)
+	double tune_speed;	// MB/s the chosen parameters must reach, 0 means only the ratio matters
 };
 
 
@@ -50,11 +99,24 @@ struct options{
  * @param opt	structure options
  * @param argc	number of arguments passed in command line
  * @param argv	array with arguments
+ *		in batch mode the arguments from optind are the files
  * @return    	0 if OK
  *		-1 if something goes wrong
  */
 int handle_options(struct options *opt, int argc, char* argv[]);
 
+/**
+ * When the data goes on the standard output (compression or decompression
+ * without -o) the messages are moved on the standard error, so they don't
+ * mix with the data in a pipe: the descriptor 1 becomes a copy of 2 and
+ * the data is written on opt->stdout_fd, a copy of the old descriptor 1.
+ *
+ * @param opt	options already handled
+ * @return    	0 if OK
+ *		-1 if something goes wrong, and errno is set
+ */
+int messages_to_stderr(struct options *opt);
+
 /**
  * Initialize the struct options :
  *
@@ -62,9 +124,26 @@ int handle_options(struct options *opt, int argc, char* argv[]);
  *	- file_out	NULL
  *	- mode		NONE
  *	- verbose	OFF
- *	- window_len	1024
- *	- look len	64
+ *	- checksum	OFF
+ *	- fast_decode	OFF
+ *	- literal_runs	ON
+ *	- block_widths	ON
+ *	- stats_file	NULL
+ *	- trace_file	NULL
+ *	- window_len	DEFAULT_WINDOW_LEN (1024)
+ *	- look len	DEFAULT_LOOK_AHEAD_LEN (64)
  *	- dict		it
+ *	- max_visits, nice_len, max_depth	0 (no limit)
+ *	- batch		OFF
+ *	- jobs		0 (one for each CPU)
+ *	- solid		OFF
+ *	- restart	ARCHIVE_RESTART (1 MiB)
+ *	- extract	NULL
+ *	- exclusive	OFF
+ *	- pipeline	ON
+ *	- io_uring	OFF
+ *	- stdout_fd	STDOUT_FILENO
+ *	- tune		OFF
  *
  * @param opt : is a pointer to option structure
  *
@@ -0,0 +1,83 @@
+/**
+ * @file pipeline.h
+ *
+ * Reader and writer threads around encode_stream() and decode_stream(), so
+ * the I/O of a file overlaps the compression: the reader thread reads the
+ * input in buffers ahead of the codec and the writer thread writes the output
+ * buffers behind it. On a slow storage the time becomes the max of I/O and
+ * CPU instead of their sum.
+ *
+ * The buffers (PIPELINE_BUFFERS for each direction) go from a thread to the
+ * other through lock-free single producer single consumer queues, a queue of
+ * full buffers and one of empty buffers for each direction, so the memory is
+ * bounded and it's allocated only at the start.
+ *
+ *	input fd -> reader -> [full] -> pipeline_read()  -> codec
+ *	                   <- [free] <-
+ *	codec -> pipeline_write() -> [full] -> writer -> output fd
+ *	                          <- [free] <-
+ *
+ * With PIPELINE_URING the reader and the writer threads use io_uring (see
+ * uring.h) on the regular files: a read is in flight for each free buffer
+ * and a write for each full one, at their offsets of the file, with the
+ * buffers registered in the kernel. If io_uring isn't available, or the
+ * file isn't a regular file, they use read() and write().
+ *
+ * @author Pischedda Alessandro
+ */
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#define PIPELINE_BUFFERS 8	// buffers for each direction
+#define PIPELINE_BUFSIZE 65536	// bytes of each buffer
+
+#define PIPELINE_URING 1	// flag of pipeline_start(), use io_uring
+
+struct pipeline;
+
+/**
+ * Start the threads.
+ *
+ * @param fd_in		file read by the reader thread, -1 if there isn't an input
+ * @param fd_out	file written by the writer thread, -1 if there isn't an output
+ * @param flags		0 or PIPELINE_URING
+ *
+ * @return		the pipeline or NULL in case of error, and set errno
+ */
+struct pipeline *pipeline_start(int fd_in, int fd_out, int flags);
+
+/**
+ * Read at most n bytes of the input, less than n only at the end of the
+ * input. It can be used as read function of an lz77_input.
+ *
+ * @return		the number of bytes read, -1 in case of error and errno is set
+ */
+int pipeline_read(void *pipeline, unsigned char *buf, int n);
+
+/**
+ * Write n bytes in the output, they are written by the writer thread so
+ * an error can be returned by a following call or by pipeline_finish().
+ * It can be used as write function of an lz77_output.
+ *
+ * @return		0 if success, -1 in case of error and errno is set
+ */
+int pipeline_write(void *pipeline, const unsigned char *buf, int n);
+
+/**
+ * Like pipeline_read() and pipeline_write() but with the interface of the
+ * io functions of bit_open_io_at().
+ */
+int pipeline_bit_read(void *pipeline, char *buf, int n);
+int pipeline_bit_write(void *pipeline, char *buf, int n);
+
+/**
+ * Write the data still in the buffers, stop the threads and free the pipeline.
+ * The files aren't closed.
+ *
+ * @return		0 if success, -1 if a write of the writer thread failed
+ *			and errno is set
+ */
+int pipeline_finish(struct pipeline *pipeline);
+
+#endif
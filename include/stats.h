@@ -0,0 +1,109 @@
+/**
+ * @file stats.h
+ *
+ * Counters collected by encode() and decode() in verbose mode (-v) or when
+ * a statistics file is given (-S). They are printed in JSON format at the
+ * end of the run and are useful to choose the window and look ahead length
+ * for a kind of data.
+ * The structure is reached through the window structure (field stats), when
+ * the counters are disabled the pointer is NULL and the hot paths only pay
+ * a test on it.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define OFFSET_BUCKETS 16	// offsets histogram, bucket i has offsets in [2^i, 2^(i+1))
+
+/**
+ * Counters of encoder and decoder.
+ *
+ * Encoder
+ *  - searches		: calls of find_match()
+ *  - search_visits	: tree nodes visited by find_match()
+ *  - search_max_visits	: max nodes visited by a single find_match()
+ *  - inserts/deletes	: calls of add_node()/delete_node()
+ *  - insert_visits	: tree nodes visited by add_node()
+ *  - search_cutoffs	: searches stopped by the max visits or the nice length
+ *  - insert_skips	: strings not inserted in the tree because too deep (max depth)
+ *			  or inside a run of a single byte
+ *  - runs		: runs of a single byte sent as matches at offset 1 without a search
+ *  - bits_*		: bits written for each field of the tokens
+ *
+ * Both
+ *  - literals, matches, forwards : tokens by type
+ *  - literal_runs	: tokens of a run of literals (HEADER_LITERAL_RUNS)
+ *  - stored		: blocks stored as they are, without a search (incompressible data,
+ *			  the byte aligned format sends them as literals)
+ *  - blocks		: blocks closed by a checksum
+ *  - width_blocks	: blocks of tokens with their own field widths (HEADER_BLOCK_WIDTHS)
+ *  - literal_bytes, match_bytes, stored_bytes : bytes encoded/decoded by literals,
+ *			  matches and stored blocks
+ *  - length_hist	: match length histogram (forward matches included)
+ *  - offset_hist	: match offset histogram (distance from the data position)
+ */
+struct lz77_stats{
+	uint64_t searches;
+	uint64_t search_visits;
+	uint64_t search_max_visits;
+	uint64_t inserts;
+	uint64_t insert_visits;
+	uint64_t search_cutoffs;
+	uint64_t insert_skips;
+	uint64_t runs;
+	uint64_t deletes;
+
+	uint64_t literals;
+	uint64_t matches;
+	uint64_t forwards;
+	uint64_t literal_runs;
+	uint64_t stored;
+	uint64_t blocks;
+	uint64_t width_blocks;
+	uint64_t literal_bytes;
+	uint64_t match_bytes;
+	uint64_t stored_bytes;
+
+	uint64_t bits_header;
+	uint64_t bits_length;
+	uint64_t bits_position;
+	uint64_t bits_literal;
+	uint64_t bits_code;	// eof, forward, block, literal run and widths codes, padding, stored lengths, widths
+	uint64_t bits_checksum;
+
+	uint64_t length_hist[256];
+	uint64_t offset_hist[OFFSET_BUCKETS];
+};
+
+/**
+ * Update the histograms with a match.
+ *
+ * @param stats		counters
+ * @param length	length of the match
+ * @param offset	distance between the data position and the match
+ */
+void stats_match(struct lz77_stats *stats, int length, int offset);
+
+/**
+ * Print the counters in JSON format.
+ *
+ * @param file		where to print
+ * @param stats		counters
+ * @param encoder	1 for the counters of encode(), 0 for decode()
+ */
+void stats_print_json(FILE *file, const struct lz77_stats *stats, int encoder);
+
+/**
+ * Print the counters on the standard error (if verbose) and write them
+ * in the file filename (if it isn't NULL).
+ *
+ * @return 0 if success, -1 if the file can't be written and errno is set
+ */
+int stats_report(const struct lz77_stats *stats, int encoder, int verbose, const char *filename);
+
+#endif
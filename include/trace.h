@@ -0,0 +1,96 @@
+/**
+ * @file trace.h
+ *
+ * Timing of the phases of encode() and decode() (dictionary load, tree
+ * build, reads, memmove, ...). The spans are written in the Chrome
+ * trace-event JSON format (chrome://tracing, Perfetto) by trace_close().
+ *
+ * Every thread stores its events in its own buffer, so the trace shows a
+ * timeline for each thread and the threads never wait each others.
+ * The short operations executed for every token (match search, bit
+ * emission, buffer flush) aren't stored one by one but their time is
+ * accumulated and attached to the span of the block (see trace_block()).
+ *
+ * When the trace isn't enabled all the functions return immediately.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+/* accumulated counters, see trace_add() */
+#define TRACE_MATCH 0	// find_match()
+#define TRACE_TREE 1	// add_node()/delete_node() after a token
+#define TRACE_EMIT 2	// bit_write()/bit_read() of the tokens, flushes included
+#define TRACE_FLUSH 3	// write()/read() of the bitfile buffer
+#define TRACE_COUNTERS 4
+
+/* 1 if the trace is enabled, it's tested by the inline functions */
+extern int trace_enabled;
+
+/**
+ * Enable the trace, the events will be written in filename by trace_close().
+ *
+ * @return 0 if success, -1 otherwise and errno is set
+ */
+int trace_open(const char *filename);
+
+/**
+ * Write all the events in the file given to trace_open() and disable the trace.
+ * It must be called when the other threads have finished.
+ *
+ * @return 0 if success, -1 otherwise and errno is set
+ */
+int trace_close(void);
+
+/**
+ * Return the current time in nanoseconds.
+ */
+uint64_t trace_now(void);
+
+/**
+ * Add ns nanoseconds to a counter of the current thread.
+ */
+void trace_counter_add(int counter, uint64_t ns);
+
+/**
+ * Return the current time in nanoseconds, 0 if the trace isn't enabled.
+ * It's the start of a span.
+ */
+static inline uint64_t trace_begin(void)
+{
+	return trace_enabled ? trace_now() : 0;
+}
+
+/**
+ * Store a span from begin to now.
+ *
+ * @param name	name of the span (it must be a constant string)
+ * @param begin	value returned by trace_begin()
+ */
+void trace_end(const char *name, uint64_t begin);
+
+/**
+ * Add the time from begin to now to a counter of the thread (TRACE_MATCH, ...).
+ */
+static inline void trace_add(int counter, uint64_t begin)
+{
+	if(trace_enabled)
+		trace_counter_add(counter, trace_now() - begin);
+}
+
+/**
+ * Store a span from begin to now with the counters of the thread as
+ * arguments, then the counters are reset.
+ */
+void trace_block(const char *name, uint64_t begin);
+
+/**
+ * Give a name to the timeline of the current thread.
+ */
+void trace_thread_name(const char *name);
+
+#endif
@@ -2,8 +2,9 @@
  * @file tree.h
  *
  * This file contains the structure data and all the functions needed to create and
- * handle a binary tree.
- * 
+ * handle a binary tree. The tree is a treap (see tree.c) so its depth stays
+ * logarithmic also with sorted or repetitive data.
+ *
  * @author Pischedda Alessandro
  */
 
@@ -11,52 +12,127 @@
 #ifndef _TREE_H_
 #define _TREE_H_
 
+#include <stdint.h>
 #include "window.h"
 
 #define ROOT 0
 #define UNUSED 0
 
+#define KEY_BYTES 4	// bytes of the string cached in the node
+
 
 /** @struct Node
  *
  * Contain the definition of the node structure that is used to build the tree.
- *  - position	is the absolute position in the window array
+ * It has only what is needed to go down the tree, so a node is 8 bytes and
+ * a search reads one cache line for each node visited.
+ *  - key	is the first KEY_BYTES bytes of the string, in big endian
+ *		order so comparing two keys is like comparing the strings
  *  - smaller	is the left son
  *  - greater	is the right son
- *  - father	the father of this node
  *
+ * The position of the string isn't stored, it's given by the index of the
+ * node (see node_position()).
+ * find_match() trusts the key, so if the first bytes of a string in the tree
+ * change (they were read after the insertion) the string must be inserted again.
  */
 struct Node{
-	int position;
-	int smaller;
-	int greater;
-	int father;
+	uint32_t key;
+	uint16_t smaller;
+	uint16_t greater;
+};
+
+/** @struct tree
+ *
+ *  - nodes	the nodes, nodes[ROOT].greater is the root of the tree
+ *  - father	father of each node, it's used only to insert and delete so
+ *		it's stored apart
+ *  - n_nodes	number of nodes (window length)
+ *  - offset	the string at position p is in the node (p + offset) % n_nodes + 1,
+ *		the plus one is used to avoid the ROOT. When the window is moved
+ *		back with memmove() the offset changes (see move_tree()) and the
+ *		tree can be kept as it is.
+ *
+ * The window lengths are at most 32767 so the indexes fit in 16 bits.
+ */
+struct tree{
+	struct Node *nodes;
+	uint16_t *father;
+	int n_nodes;
+	int offset;
 };
 
 
 /**
  * Build and initialize the tree.
- * Using the calloc and the definition of UNUSED the initialization is automatic. 
+ * Using the calloc and the definition of UNUSED the initialization is automatic.
  *
  * @param length	it's the number of nodes
- * 
- * @return		struct Node pointer
+ *
+ * @return		struct tree pointer
  *			NULL in case of error
  * ERRORS
  *	EINVAL		if some function's arguments isn't correct.
  *	Others		are all the possible error returned by calloc() function.
  */
-struct Node* build_tree( int length);
+struct tree* build_tree( int length);
+
+/**
+ * Free the memory used by the tree.
+ */
+void free_tree(struct tree *tree);
+
+
+/**
+ * Ask the CPU to load the memory at address p in the cache, the tree descents
+ * use it to read the sons of a node while the node is compared.
+ */
+#define prefetch(p) __builtin_prefetch(p)
+
+/**
+ * Return the key of the string that starts in s.
+ */
+static inline uint32_t string_key(const unsigned char *s)
+{
+	return ((uint32_t)s[0] << 24) | ((uint32_t)s[1] << 16) | ((uint32_t)s[2] << 8) | s[3];
+}
+
+/**
+ * Return the index of the node of the string at position pos.
+ */
+static inline int node_index(const struct tree *tree, int pos)
+{
+	return ( pos + tree->offset ) % tree->n_nodes + 1;
+}
+
+/**
+ * Return the position of the string in the node, the tree has only the strings
+ * of the dictionary so it's the only position between dict_position and
+ * dict_position + window_length with the node index.
+ *
+ * @param node		index of the node
+ * @param dict_position	position of the dictionary in the window
+ * @param dict_node	index of the node of dict_position (see node_index())
+ */
+static inline int node_position(const struct tree *tree, int node, int dict_position, int dict_node)
+{
+	int distance = node - dict_node;
+
+	if( distance < 0 )
+		distance += tree->n_nodes;
+	return dict_position + distance;
+}
 
 
 /**
  * Add node in the Tree.
+ * If the node would be deeper than window->max_depth it isn't inserted.
  *
  * @param tree	tree where add the node
- * @param node	value of node to add
- * @param window 
+ * @param node	position of the string to add
+ * @param window
  */
-void add_node( struct Node *tree, int node, const struct window *window);
+void add_node( struct tree *tree, int node, const struct window *window);
 
 
 /**
@@ -64,10 +140,9 @@ void add_node( struct Node *tree, int node, const struct window *window);
  *
  * @param tree		tree from where remove the node
  * @param node		is the position of the string in the window array
- * @param win_length	window length, used to calculate modulo 
  *
  */
-void delete_node(struct Node *tree, int node, int win_length);
+void delete_node(struct tree *tree, int node);
 
 /**
  * Used in function delete_node() when one of the sons of the node to delete is UNUSED.
@@ -77,39 +152,30 @@ void delete_node(struct Node *tree, int node, int win_length);
  * @param node	node to be replace
  * @param son 	son who replace the node
  */
-void level_up(struct Node *tree, int node, int son);
+void level_up(struct tree *tree, int node, int son);
 
 /**
- * Find the bigger left son of a node. This function is used by the delete function.
- * It's a left son in order to don't touch the right part of the tree.
- *
- * @param tree	tree strcuture
- * @param node	node from where search the bigger left son
- * @return	the index of the greater son of the node "node"
- */
-int find_max_son(struct Node *tree, int node);
-
-/**
- * Replace old_node with the new_node
+ * All the field of all node will be set UNUSED.
+ * Is usefull when you have to "delete" all nodes without using delete_node().
  *
- * @param old_node : to be replaced
- * @param new_node : node replace with.
+ * @param tree : tree structure to empty
  */
-void replace_node(struct Node *tree, int old_node, int new_node);
+void empty_tree(struct tree *tree);
 
 /**
- * All the field of all node will be set UNUSED.
- * Is usefull when you have to "delete" all nodes without using delete_node().
+ * The window was moved back of shift bytes (the string at position p is now at
+ * position p - shift), update the tree so that it can be used without
+ * building it again.
  *
- * @param tree : tree structure to fill with zeros
- * @param n_nodes : the number of nodes in the tree
+ * @param tree	: tree structure
+ * @param shift	: how many bytes the window was moved
  */
-void empty_tree(struct Node *tree, int n_nodes);
+void move_tree(struct tree *tree, int shift);
 
 
 /**
- * Similar to strncmp, except it can compares strings that land across the 
- * sliding window. It use the function wrap().
+ * Similar to strncmp, compares the look_ah_length bytes that start in s1 and
+ * s2 (or less at the end of the window array).
  *
  * @param w  : window structure
  * @param s1 : position of the first character of the first string
@@ -120,6 +186,17 @@ void empty_tree(struct Node *tree, int n_nodes);
 int window_cmp(const struct window *w, int s1, int s2);
 
 
+/**
+ * Search in the tree the longest match for the string at w.data_position.
+ * It's used by encode() (file lz77encode.c).
+ *
+ * @param tree		: tree structure
+ * @param w  		: window structure
+ *
+ * @return		: the match found (see struct match in window.h)
+ */
+struct match find_match(struct tree *tree, struct window w);
+
+
 
 #endif
-
@@ -0,0 +1,40 @@
+/**
+ * @file tune.h
+ *
+ * Automatic choice of the parameters (--auto): a few slices of the input
+ * are compressed in memory with each candidate window length, look ahead
+ * length and search mode (plain or with the search effort limits), by a
+ * pool of threads, and the candidate with the best ratio among the ones
+ * that reach the requested speed is kept. Then the dictionaries are tried
+ * on the first slice, the only part of the file where they're used.
+ * The speed of a candidate is measured in CPU time of its thread, so the
+ * candidates compressed at the same time don't slow down each other's
+ * measure.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#ifndef _TUNE_H_
+#define _TUNE_H_
+
+#include "option.h"
+
+#define TUNE_SLICE 65536	// bytes of a slice of the input
+#define TUNE_SLICES 3	// slices at the start, in the middle and at the end
+
+/**
+ * Choose window_len, look_ahead_len, dict and the search effort limits of
+ * opt for its input, which must be a regular file (-i or the standard
+ * input redirected from a file). The objective is the smallest output
+ * among the candidates that compress at least opt->tune_speed MB/s (0 means
+ * only the ratio matters), the fastest candidate if none of them does.
+ * The other options (checksum, token format, ...) are used as they are.
+ * With opt->verbose each candidate and the choice are printed.
+ *
+ * @param opt	options to change
+ *
+ * @return	0 if successfully work and -1 if something goes wrong.
+ */
+int tune_options(struct options *opt);
+
+#endif
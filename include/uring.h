@@ -0,0 +1,106 @@
+/**
+ * @file uring.h
+ *
+ * Minimal io_uring ring (Linux) used by the reader and writer threads of the
+ * pipeline (see pipeline.h): many reads or writes are in flight at the same
+ * time with a single system call, the buffers can be registered in the
+ * kernel so they aren't mapped at each operation.
+ * It uses the system calls directly, liburing isn't needed. Where io_uring
+ * isn't available (other systems, old kernels, seccomp) uring_init() fails
+ * and the caller uses read()/write().
+ *
+ * @author Pischedda Alessandro
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define URING_READ 0
+#define URING_WRITE 1
+
+/**
+ * A ring, the fields are private
+ */
+struct uring{
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	void *sqes;
+	void *cqes;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+	unsigned to_submit;	// operations prepared and not yet given to the kernel
+	int registered;		// the buffers are registered
+};
+
+/**
+ * Create a ring.
+ *
+ * @param entries	max operations in flight, a power of two
+ *
+ * @return		0 if success, -1 otherwise and errno is set (ENOSYS
+ *			where io_uring isn't available)
+ */
+int uring_init(struct uring *ring, unsigned entries);
+
+/**
+ * Register the buffers used by the operations, it can fail (for example
+ * for the limit of locked memory) and the ring works without.
+ *
+ * @return		0 if success, -1 otherwise and errno is set
+ */
+int uring_register(struct uring *ring, const struct iovec *iov, unsigned n);
+
+/**
+ * Prepare a read or a write of len bytes at offset off of fd, it's given to
+ * the kernel by the next uring_wait().
+ *
+ * @param op		URING_READ or URING_WRITE
+ * @param index		index of buf in the registered buffers, it's used only
+ *			if they are registered
+ * @param data		returned by uring_wait() when the operation completes
+ */
+void uring_prep(struct uring *ring, int op, int fd, void *buf, unsigned len,
+		uint64_t off, unsigned index, void *data);
+
+/**
+ * Submit the operations prepared and wait for the completion of one.
+ *
+ * @param data		where to store the data of the operation completed
+ * @param res		where to store its result: bytes read or written, or
+ *			-errno
+ *
+ * @return		0 if success, -1 otherwise and errno is set
+ */
+int uring_wait(struct uring *ring, void **data, int *res);
+
+/**
+ * Wait for the end of the n operations in flight and discard their results,
+ * it's used after an error of uring_wait() so that the buffers can be given
+ * back: the operations prepared and not yet submitted are dropped, the
+ * others complete (the reads and writes of regular files don't block).
+ *
+ * @param n		operations prepared and not yet completed
+ *
+ * @return		0 if success, -1 if the kernel can still use some of the
+ *			buffers, and errno is set
+ */
+int uring_drain(struct uring *ring, int n);
+
+/**
+ * Destroy the ring, there must not be operations in flight.
+ */
+void uring_exit(struct uring *ring);
+
+#endif
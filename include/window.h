@@ -15,6 +15,8 @@
 
 #include "option.h"
 #include "bitio.h"
+#include "dictionary.h"
+#include "stats.h"
 
 // the following instructions are needed to use macro __BYTE_ORDER__
 #if __FreeBSD__
@@ -36,6 +38,12 @@
  *  - data_position	: indicate the position of look ahead buffer in the window 
  *  - dict-position	: indicate the begining of dictionaty in window array
  *  - window		: text array that will contains text data and dictionary data
+ *  - stats		: counters (see stats.h), NULL if they are disabled
+ *  - max_visits	: max tree nodes visited by find_match(), 0 means no limit
+ *  - nice_length	: find_match() stops as soon as it finds a match at least this long,
+ *			  0 means look_ah_length
+ *  - max_depth		: max depth where add_node() inserts a node, the deeper strings
+ *			  aren't inserted (they can't be found). 0 means no limit
  */
 struct window{
         // dictionary length 
@@ -47,18 +55,24 @@ struct window{
     	// indicate the begining of dictionaty in window array
 	int dict_position;
 	unsigned char* window;	
+	struct lz77_stats *stats;
+	// search effort limits
+	int max_visits;
+	int nice_length;
+	int max_depth;
 };
 
 /** 
- * The function copy_dictionary() copy a dictionary from a file to 
- * window structure.
+ * The function load_dictionary() copy a dictionary in the first window_length
+ * bytes of the window structure. If the dictionary is shorter than the window
+ * it's repeated until the window is full.
  *
  * @param w		is the window structure where copy the dictionary
- * @param filename	is the filename of the file that has the dictionary
+ * @param dict		is the dictionary to copy (see dictionary.h)
  *
  * @return 		0 success and -1 if something goes wrong
  */
-int load_dictionary(const struct window* w, char* filename);
+int load_dictionary(const struct window* w, const struct dictionary *dict);
 
 /**
  * Check if it'll be a wrap-around and in case return the correct position of the
@@ -90,7 +104,7 @@ int number_of_bits(int x);
  *		  1 if the match look into look_ahead buffer
  */
 struct match{
-    uint8_t len;
+    int len;
     uint16_t position;
     uint8_t type;
 };
@@ -98,6 +112,83 @@ struct match{
 
 /* header FILE PART */
 
+/* flags of the header */
+#define HEADER_CHECKSUM 0x0001	// the data has a CRC32C for each block and for the whole content
+#define HEADER_BYTES 0x0002	// the tokens are byte aligned sequences (see below)
+#define HEADER_LITERAL_RUNS 0x0004	// the bit format has the literal run code and the stored blocks (see struct token_codes)
+#define HEADER_BLOCK_WIDTHS 0x0008	// the bit format has the field widths of each block of tokens (see struct token_codes)
+
+/* byte aligned format (HEADER_BYTES)
+ * After the header the data is a list of sequences, each one is a run of
+ * literals followed by a match:
+ *
+ *	TOKEN [LITERALS LENGTH] LITERALS POSITION [MATCH LENGTH]
+ *
+ *  - TOKEN		1 byte, the 4 most significant bits are the number of
+ *			literals and the others the length of the match less
+ *			BYTES_MIN_MATCH, 15 means that the value goes on in the
+ *			following bytes (LITERALS LENGTH, MATCH LENGTH): each one
+ *			is added and the last is less than 255.
+ *  - LITERALS		the literal bytes, at most BYTES_MAX_LITERALS
+ *  - POSITION		2 bytes little endian, the position of the match in the
+ *			dictionary like in the bit format and, in the most
+ *			significant bit, 1 for a forward match.
+ *			BYTES_CONTROL means that there isn't a match: the match
+ *			length of the token is BYTES_EOF (followed by the checksum
+ *			of the content if the file has them), BYTES_BLOCK (followed
+ *			by the checksum of the block) or BYTES_LITERALS (only the
+ *			literals).
+ * The checksums are 4 bytes in network order like in the bit format.
+ * The decoder reads whole bytes and copies the literals with memcpy().
+ */
+#define BYTES_MIN_MATCH 4	// a shorter match costs more than its literals
+#define BYTES_MAX_LITERALS 4096	// literals of a sequence
+#define BYTES_CONTROL 0xFFFF	// position of the sequences without a match
+#define BYTES_EOF 0
+#define BYTES_BLOCK 1
+#define BYTES_LITERALS 2
+
+/* codes of the bit format */
+
+/**
+ * Codes and field widths of the bit format. The length field has the match
+ * lengths up to max_length and after them the codes:
+ *  - eof	max_length + 1
+ *  - forward	max_length + 2, followed by the length and the position
+ *  - block	max_length + 3, followed by the checksum of the block
+ *  - literals	max_length + 4, followed by the number of literals, the padding
+ *		and the literals; 0 literals is a stored block (HEADER_LITERAL_RUNS,
+ *		-1 without it)
+ *  - widths	max_length + 5, followed by max_length in 8 bits and
+ *		bits_position in 4 bits of the next block of tokens
+ *		(HEADER_BLOCK_WIDTHS, -1 without it)
+ * Without HEADER_BLOCK_WIDTHS max_length is the look ahead length and the
+ * widths are the same for the whole file, with it they're the ones of the
+ * tokens of each block and the position field is the distance of the match
+ * less 1, so a block of short matches has narrow fields.
+ */
+struct token_codes{
+	int max_length;
+	int bits_length;
+	int bits_position;
+	int eof;
+	int forward;
+	int block;
+	int literals;
+	int widths;
+};
+
+/**
+ * Set the codes and the widths for the longest length field max_length and
+ * a position field of bits_position bits.
+ *
+ * @param codes		codes to set
+ * @param max_length	longest length field
+ * @param bits_position	bits of the position field
+ * @param flags		flags of the header (HEADER_LITERAL_RUNS and HEADER_BLOCK_WIDTHS)
+ */
+void set_token_codes(struct token_codes *codes, int max_length, int bits_position, int flags);
+
 /**
  * Contain the information about the header for the compress file.
  * header is used to contain information in order to have a correct decompressor's 
@@ -105,11 +196,12 @@ struct match{
  * Simplest description of the fields :
  *  - magic number  : define the file format
  *  - header_len    : it's the header length
- *  - ver           : version of the software used to do the file
+ *  - ver           : version of the format, 2 or 3 if it uses the flags after HEADER_CHECKSUM
  *  - byte_order    : if the file was writen with a big/little endian processor
  *  - look_ah_len   : look ahead buffer length
  *  - window_len    : sliding window length
- *  - dict          : dictionary preloaded. It can be "it", "en" or others
+ *  - dict_id       : content ID of the dictionary preloaded (see dictionary.h)
+ *  - flags         : features used in the compressed data (see HEADER_* flags)
  *
  *  31             23               15               7              0
  *  ______________ ________________ ________________ ________________
@@ -120,9 +212,13 @@ struct match{
  * |  LOOK AH LEN |    ENDIAN      |    VERSION     |  header LEN    |
  * |______________|________________|________________|________________|
  * |                               |                                 |
- * |           DICTIONARY          |            window LEN	     |
+ * |            FLAGS              |            window LEN	     |
  * |_______________________________|_________________________________|
+ * |                                                                 |
+ * |                          DICTIONARY ID                          |
+ * |_________________________________________________________________|
  *
+ * The window length, the flags and the dictionary ID are stored in network order.
  */
 struct header{
 	// magic number
@@ -137,8 +233,10 @@ struct header{
 	uint8_t look_ah_len; 
 	// window length
 	uint16_t window_len; 
-	// dictionary name
-	char dict[2];
+	// features used in the data
+	uint16_t flags;
+	// dictionary content ID
+	uint32_t dict_id;
 };
 
 /**
@@ -156,6 +254,15 @@ struct header{
  */
 struct header * build_header(const struct options *opt);
 
+/**
+ * Like build_header() but the header is given by the caller.
+ *
+ * @param header	header structure to initialize
+ * @param options	structure options (see option.h)
+ * @return 		0 success and -1 if something goes wrong, and set errno
+ */
+int init_header(struct header *header, const struct options *opt);
+
 
 /**
  * This function write the header in a file specified by variable b_file.
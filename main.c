@@ -44,9 +44,12 @@
  *	Features 
  *		- window/look ahead length choosen by the user 
  *		- dictionary pre-loaded
- *		- possibility to choose a file that contain a dictionary
- *		- can use STDIN in compression mode and STDOUT in decompression mode
+ *		- possibility to choose a dictionary among the ones compiled in the software
+ *		- can use STDIN and STDOUT in both modes, so it works as a filter in a pipe
  *		- check if a no match case is better than a match one
+ *		- batch mode, many files compressed by a pool of threads
+ *		- solid archives, many files compressed through the same window
+ *		- window/look ahead length, dictionary and search limits chosen sampling the input
  *
  *
  */
@@ -57,6 +60,10 @@
 #include <stdlib.h>
 #include "include/option.h"
 #include "include/lz77.h"
+#include "include/trace.h"
+#include "include/batch.h"
+#include "include/archive.h"
+#include "include/tune.h"
 
 
 
@@ -74,14 +81,33 @@ int main (int argc, char* argv[])
 	ret = init_opt(&opt);
 	if( ret != -1){
 		ret = handle_options(&opt,argc,argv);
+		if( ret != -1)
+			ret = messages_to_stderr(&opt);
+		if( ret != -1 && opt.trace_file != NULL)
+			ret = trace_open(opt.trace_file);
 		if( ret != -1){
 	
-			if (opt.mode){
-				ret = encode(opt);
+			if (opt.solid){
+				if (opt.mode == COMPRESSION)
+					ret = archive_create(opt, argv + optind, argc - optind);
+				else
+					ret = archive_extract(opt);
 			}
-			else{
+			else if (opt.batch){
+				ret = batch(opt, argv + optind, argc - optind);
+			}
+			else if (opt.mode == COMPRESSION){
+				if (opt.tune)
+					ret = tune_options(&opt);
+				if (ret != -1)
+					ret = encode(opt);
+			}
+			else{ // decompression or test
 				ret = decode(opt);
 			}
+
+			if( trace_close() == -1)
+				ret = -1;
 		}
 	}
 
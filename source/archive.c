@@ -0,0 +1,778 @@
+/**
+ * @file archive.c
+ *
+ * The encoder reads the files one after the other through an lz77_input
+ * (see archive_read()) that stops at each restart point, so encode_stream()
+ * sees a piece of the content as if it were a file. The decoder does the
+ * opposite with an lz77_output (see archive_write()) that cuts the content
+ * in the files.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#include <arpa/inet.h>
+#include "../include/archive.h"
+#include "../include/batch.h"
+#include "../include/lz77.h"
+
+#define ARCHIVE_HEADER_LEN 8
+#define ARCHIVE_TRAILER_LEN 12
+#define ARCHIVE_MAX_NAME UINT16_MAX
+
+static const char archive_magic[4] = { 'L', 'Z', '7', 'A' };
+static const char trailer_magic[4] = { 'L', 'Z', '7', 'T' };
+
+/**
+ * A file of the archive, the offset is in the content.
+ */
+struct archive_file{
+	char *name;
+	uint64_t offset;
+	uint64_t size;
+};
+
+/**
+ * A restart point: the stream starts in the archive at offset stream and its
+ * data starts in the content at offset.
+ */
+struct archive_restart{
+	uint64_t stream;
+	uint64_t offset;
+};
+
+/**
+ * The table of an archive.
+ */
+struct archive_table{
+	struct archive_restart *restarts;
+	int n_restarts;
+	struct archive_file *files;
+	int n_files;
+};
+
+/**
+ * Memory where the table is built before to write it.
+ */
+struct buffer{
+	unsigned char *data;
+	size_t len;
+	size_t size;
+};
+
+
+/**
+ * Write n bytes in fd, write() can write less bytes than requested.
+ *
+ * @return	0 if success, -1 otherwise
+ */
+static int write_full(int fd, const void *buf, size_t n)
+{
+	const unsigned char *p = buf;
+	ssize_t r;
+
+	while(n > 0){
+		r = write(fd, p, n);
+		if(r == -1){
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		n -= r;
+	}
+	return 0;
+}
+
+/**
+ * Append n bytes to the buffer.
+ *
+ * @return	0 if success, -1 otherwise
+ */
+static int put(struct buffer *b, const void *data, size_t n)
+{
+	if(b->len + n > b->size){
+		size_t size = b->size == 0 ? 4096 : b->size;
+		unsigned char *bigger;
+
+		while(size < b->len + n)
+			size *= 2;
+		bigger = realloc(b->data, size);
+		if(bigger == NULL)
+			return -1;
+		b->data = bigger;
+		b->size = size;
+	}
+	memcpy(b->data + b->len, data, n);
+	b->len += n;
+	return 0;
+}
+
+static int put_u16(struct buffer *b, uint16_t x)
+{
+	x = htons(x);
+	return put(b, &x, 2);
+}
+
+static int put_u32(struct buffer *b, uint32_t x)
+{
+	x = htonl(x);
+	return put(b, &x, 4);
+}
+
+static int put_u64(struct buffer *b, uint64_t x)
+{
+	return put_u32(b, x >> 32) == -1 ? -1 : put_u32(b, (uint32_t)x);
+}
+
+static uint16_t get_u16(const unsigned char *p)
+{
+	return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_u64(const unsigned char *p)
+{
+	return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+
+/* compression */
+
+/**
+ * Input of encode_stream(): the files one after the other, until the next
+ * restart point.
+ *  - current	file being read
+ *  - fd	its descriptor, -1 if it isn't open yet
+ *  - position	offset in the content of the next byte
+ *  - left	bytes before the next restart point
+ */
+struct archive_input{
+	struct archive_file *files;
+	int n_files;
+	int current;
+	int fd;
+	uint64_t position;
+	uint64_t left;
+};
+
+static int archive_read(void *arg, unsigned char *buf, int n)
+{
+	struct archive_input *in = arg;
+	struct archive_file *f;
+	int done = 0;
+	ssize_t r;
+	size_t want;
+
+	while(done < n && in->left > 0 && in->current < in->n_files){
+		f = &in->files[in->current];
+		if(in->fd == -1){
+			in->fd = open(f->name, O_RDONLY);
+			if(in->fd == -1){
+				printf("ERROR!!! %s can't be read: %s\n", f->name, strerror(errno));
+				return -1;
+			}
+			f->offset = in->position;
+			f->size = 0;
+		}
+
+		want = n - done;
+		if(want > in->left)
+			want = in->left;
+		r = read(in->fd, buf + done, want);
+		if(r == -1){
+			if(errno == EINTR)
+				continue;
+			printf("ERROR!!! %s can't be read: %s\n", f->name, strerror(errno));
+			return -1;
+		}
+		if(r == 0){ // next file
+			close(in->fd);
+			in->fd = -1;
+			in->current++;
+			continue;
+		}
+		done += r;
+		f->size += r;
+		in->position += r;
+		in->left -= r;
+	}
+
+	return done;
+}
+
+/**
+ * Return 0 if the name can be used to create a file: not absolute and without "..".
+ */
+static int check_name(const char *name)
+{
+	const char *p = name;
+
+	if(*name == '\0' || *name == '/')
+		return -1;
+	while(*p != '\0'){
+		if(p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+			return -1;
+		p = strchr(p, '/');
+		if(p == NULL)
+			break;
+		p++;
+	}
+	return 0;
+}
+
+/**
+ * Return the name of a file in the archive: like tar the leading '/' are
+ * removed, so an absolute path is extracted under the current directory.
+ */
+static const char *member_name(const char *name)
+{
+	while(*name == '/')
+		name++;
+	return name;
+}
+
+/**
+ * Write the table and the trailer at the current offset of fd.
+ *
+ * @return	0 if success, -1 otherwise
+ */
+static int write_table(int fd, const struct archive_table *table)
+{
+	struct buffer b = { NULL, 0, 0 };
+	off_t offset;
+	int i, ret = 0;
+
+	offset = lseek(fd, 0, SEEK_CUR);
+	if(offset == -1)
+		return -1;
+
+	ret |= put_u32(&b, table->n_restarts);
+	for(i = 0; i < table->n_restarts; i++){
+		ret |= put_u64(&b, table->restarts[i].stream);
+		ret |= put_u64(&b, table->restarts[i].offset);
+	}
+	ret |= put_u32(&b, table->n_files);
+	for(i = 0; i < table->n_files; i++){
+		const char *name = member_name(table->files[i].name);
+		size_t len = strlen(name);
+
+		ret |= put_u64(&b, table->files[i].offset);
+		ret |= put_u64(&b, table->files[i].size);
+		ret |= put_u16(&b, len);
+		ret |= put(&b, name, len);
+	}
+	ret |= put_u64(&b, offset);
+	ret |= put(&b, trailer_magic, 4);
+
+	if(ret == 0)
+		ret = write_full(fd, b.data, b.len);
+	free(b.data);
+	return ret == 0 ? 0 : -1;
+}
+
+int archive_create(struct options opt, char **files, int n_files)
+{
+	struct lz77_context *ctx = NULL;
+	struct archive_input in;
+	struct archive_table table;
+	struct bitfile *b_file;
+	struct lz77_stats stats;
+	struct lz77_stats *p_stats = NULL;
+	unsigned char header[ARCHIVE_HEADER_LEN] = { 0 };
+	char **list = NULL;
+	off_t size;
+	int fd = -1;
+	int i, ret = -1;
+
+	memset(&table, 0, sizeof(table));
+	memset(&in, 0, sizeof(in));
+	in.fd = -1;
+
+	if(n_files == 0){
+		n_files = batch_read_list(&list);
+		if(n_files == -1)
+			return -1;
+		files = list;
+	}
+	if(n_files == 0){
+		printf("No files to compress\n");
+		return -1;
+	}
+
+	table.files = calloc(n_files, sizeof(struct archive_file));
+	if(table.files == NULL)
+		goto end;
+	table.n_files = n_files;
+	for(i = 0; i < n_files; i++){
+		if(strlen(files[i]) > ARCHIVE_MAX_NAME){
+			printf("ERROR!!! the name %.32s... is too long\n", files[i]);
+			goto end;
+		}
+		// the same names that the extraction accepts
+		if(check_name(member_name(files[i])) == -1){
+			printf("ERROR!!! %s isn't a valid name for a file\n", files[i]);
+			goto end;
+		}
+		table.files[i].name = files[i];
+	}
+
+	ctx = lz77_context_create(COMPRESSION, opt.window_len);
+	if(ctx == NULL)
+		goto end;
+
+	print_options(opt);
+	if(opt.verbose || opt.stats_file != NULL){
+		bzero(&stats, sizeof(stats));
+		p_stats = &stats;
+	}
+	// the streams don't print anything
+	opt.quiet = 1;
+
+	fd = open(opt.file_out, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if(fd == -1)
+		goto end;
+	memcpy(header, archive_magic, 4);
+	header[4] = ARCHIVE_VERSION;
+	if(write_full(fd, header, ARCHIVE_HEADER_LEN) == -1)
+		goto end;
+
+	in.files = table.files;
+	in.n_files = n_files;
+
+	// a stream for each restart point, until all the files are read
+	do{
+		if(table.n_restarts % 64 == 0){
+			struct archive_restart *bigger;
+
+			bigger = realloc(table.restarts, (table.n_restarts + 64) * sizeof(struct archive_restart));
+			if(bigger == NULL)
+				goto end;
+			table.restarts = bigger;
+		}
+		table.restarts[table.n_restarts].stream = lseek(fd, 0, SEEK_CUR);
+		table.restarts[table.n_restarts].offset = in.position;
+		table.n_restarts++;
+
+		in.left = opt.restart > 0 ? opt.restart : UINT64_MAX;
+		b_file = bit_fdopen_at(fd, BIT_WR, CONTEXT_BUFSIZE, ctx->bitfile);
+		if(encode_stream(ctx, opt, &(struct lz77_input){ archive_read, &in }, b_file, p_stats) == -1){
+			bit_close(b_file);
+			goto end;
+		}
+		// the next stream starts at a byte boundary
+		if(bit_flush(b_file) == -1)
+			goto end;
+		bit_close(b_file);
+	}while(in.current < in.n_files);
+
+	if(write_table(fd, &table) == -1)
+		goto end;
+	size = lseek(fd, 0, SEEK_CUR);
+	if(close(fd) == -1){
+		fd = -1;
+		goto end;
+	}
+	fd = -1;
+
+	printf("Archive : %d files, %llu bytes -> %llu bytes, %d restart points\n", n_files,
+	       (unsigned long long)in.position, (unsigned long long)size, table.n_restarts);
+	ret = 0;
+	if(p_stats != NULL && stats_report(&stats, 1, opt.verbose, opt.stats_file) == -1)
+		ret = -1;
+
+end:
+	if(in.fd != -1)
+		close(in.fd);
+	if(fd != -1){
+		close(fd);
+		remove(opt.file_out);
+	}
+	lz77_context_free(ctx);
+	free(table.restarts);
+	free(table.files);
+	if(list != NULL){
+		for(i = 0; i < n_files; i++)
+			free(list[i]);
+		free(list);
+	}
+	return ret;
+}
+
+
+/* decompression */
+
+static void free_table(struct archive_table *table)
+{
+	int i;
+
+	if(table->files != NULL)
+		for(i = 0; i < table->n_files; i++)
+			free(table->files[i].name);
+	free(table->files);
+	free(table->restarts);
+	memset(table, 0, sizeof(struct archive_table));
+}
+
+/**
+ * Read and check the table of the archive.
+ *
+ * @return	0 if success, -1 otherwise
+ */
+static int read_table(int fd, struct archive_table *table)
+{
+	unsigned char header[ARCHIVE_HEADER_LEN];
+	unsigned char trailer[ARCHIVE_TRAILER_LEN];
+	unsigned char *data = NULL, *p, *end;
+	uint64_t table_offset, content = 0;
+	struct stat st;
+	int i;
+
+	memset(table, 0, sizeof(struct archive_table));
+
+	if(fstat(fd, &st) == -1)
+		return -1;
+	if(st.st_size < ARCHIVE_HEADER_LEN + ARCHIVE_TRAILER_LEN ||
+	   pread(fd, header, ARCHIVE_HEADER_LEN, 0) != ARCHIVE_HEADER_LEN ||
+	   pread(fd, trailer, ARCHIVE_TRAILER_LEN, st.st_size - ARCHIVE_TRAILER_LEN) != ARCHIVE_TRAILER_LEN ||
+	   memcmp(header, archive_magic, 4) != 0 || memcmp(trailer + 8, trailer_magic, 4) != 0){
+		printf("This file isn't a solid archive\n");
+		return -1;
+	}
+	if(header[4] != ARCHIVE_VERSION){
+		printf("Unsupported version of the archive: %d\n", header[4]);
+		return -1;
+	}
+
+	table_offset = get_u64(trailer);
+	if(table_offset < ARCHIVE_HEADER_LEN || table_offset > (uint64_t)st.st_size - ARCHIVE_TRAILER_LEN)
+		goto corrupted;
+	data = malloc(st.st_size - ARCHIVE_TRAILER_LEN - table_offset + 1);
+	if(data == NULL)
+		return -1;
+	end = data + (st.st_size - ARCHIVE_TRAILER_LEN - table_offset);
+	if(pread(fd, data, end - data, table_offset) != end - data)
+		goto corrupted;
+
+	// each field is checked before to read it
+	#define NEED(n) do{ if((size_t)(end - p) < (size_t)(n)) goto corrupted; }while(0)
+
+	p = data;
+	NEED(4);
+	table->n_restarts = get_u32(p);
+	p += 4;
+	if(table->n_restarts <= 0 || (uint64_t)table->n_restarts > (uint64_t)(end - p) / 16)
+		goto corrupted;
+	table->restarts = calloc(table->n_restarts, sizeof(struct archive_restart));
+	if(table->restarts == NULL)
+		goto error;
+	for(i = 0; i < table->n_restarts; i++){
+		table->restarts[i].stream = get_u64(p);
+		table->restarts[i].offset = get_u64(p + 8);
+		p += 16;
+		if(table->restarts[i].stream < ARCHIVE_HEADER_LEN || table->restarts[i].stream >= table_offset)
+			goto corrupted;
+		if(i > 0 && (table->restarts[i].stream <= table->restarts[i-1].stream ||
+			     table->restarts[i].offset < table->restarts[i-1].offset))
+			goto corrupted;
+	}
+	if(table->restarts[0].offset != 0)
+		goto corrupted;
+
+	NEED(4);
+	table->n_files = get_u32(p);
+	p += 4;
+	if(table->n_files < 0 || (uint64_t)table->n_files > (uint64_t)(end - p) / 18)
+		goto corrupted;
+	table->files = calloc(table->n_files, sizeof(struct archive_file));
+	if(table->files == NULL)
+		goto error;
+	for(i = 0; i < table->n_files; i++){
+		int len;
+
+		NEED(18);
+		table->files[i].offset = get_u64(p);
+		table->files[i].size = get_u64(p + 8);
+		len = get_u16(p + 16);
+		p += 18;
+		NEED(len);
+		table->files[i].name = strndup((char*)p, len);
+		if(table->files[i].name == NULL)
+			goto error;
+		p += len;
+
+		// the files are one after the other
+		if(table->files[i].offset != content || table->files[i].size > UINT64_MAX - content)
+			goto corrupted;
+		content += table->files[i].size;
+	}
+	if(p != end || table->restarts[table->n_restarts - 1].offset > content)
+		goto corrupted;
+
+	#undef NEED
+
+	free(data);
+	return 0;
+
+corrupted:
+	printf("Corrupted archive: the table isn't valid\n");
+	errno = EINVAL;
+error:
+	free(data);
+	free_table(table);
+	return -1;
+}
+
+/**
+ * Output of decode_stream(): the content is cut in the files from current to
+ * last (excluded), the bytes out of them are discarded.
+ *  - current	first file not yet complete
+ *  - fd	output of the current file, -1 if it isn't open
+ *  - single	fd is given by the caller and all the files go in it
+ *  - test	the files aren't written
+ *  - position	offset in the content of the next byte decoded
+ */
+struct archive_output{
+	struct archive_file *files;
+	int current;
+	int last;
+	int fd;
+	int single;
+	int test;
+	uint64_t position;
+};
+
+/**
+ * Open the output of the current file, the directories in its name are created.
+ */
+static int open_output(struct archive_output *o)
+{
+	char *name = o->files[o->current].name;
+	char *slash;
+
+	if(o->single || o->test)
+		return 0;
+
+	if(check_name(name) == -1){
+		printf("ERROR!!! %s isn't a valid name for a file\n", name);
+		errno = EINVAL;
+		return -1;
+	}
+	for(slash = strchr(name, '/'); slash != NULL; slash = strchr(slash + 1, '/')){
+		*slash = '\0';
+		if(mkdir(name, 0777) == -1 && errno != EEXIST){
+			printf("ERROR!!! the directory %s can't be created: %s\n", name, strerror(errno));
+			*slash = '/';
+			return -1;
+		}
+		*slash = '/';
+	}
+
+	o->fd = open(name, O_WRONLY|O_CREAT|O_EXCL, 0666);
+	if(o->fd == -1){
+		printf("ERROR!!! %s can't be created: %s\n", name, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * The current file is complete: close it (an empty file is created now) and
+ * go to the next one.
+ */
+static int next_file(struct archive_output *o)
+{
+	if(!o->single && !o->test){
+		if(o->fd == -1 && open_output(o) == -1)
+			return -1;
+		if(close(o->fd) == -1)
+			return -1;
+		o->fd = -1;
+	}
+	o->current++;
+	return 0;
+}
+
+static int archive_write(void *arg, const unsigned char *buf, int n)
+{
+	struct archive_output *o = arg;
+	struct archive_file *f;
+	uint64_t k;
+
+	while(n > 0){
+		if(o->current >= o->last){ // after the files wanted
+			o->position += n;
+			return 0;
+		}
+
+		f = &o->files[o->current];
+		if(o->position < f->offset){ // before the file
+			k = f->offset - o->position;
+		}else if(o->position >= f->offset + f->size){
+			if(next_file(o) == -1)
+				return -1;
+			continue;
+		}else{
+			k = f->offset + f->size - o->position;
+			if(k > (uint64_t)n)
+				k = n;
+			if(o->fd == -1 && open_output(o) == -1)
+				return -1;
+			if(o->fd != -1 && write_full(o->fd, buf, k) == -1)
+				return -1;
+		}
+		if(k > (uint64_t)n)
+			k = n;
+		buf += k;
+		n -= k;
+		o->position += k;
+	}
+	return 0;
+}
+
+/**
+ * Close the files completed by the last bytes, the files wanted must be all complete.
+ */
+static int finish_output(struct archive_output *o)
+{
+	while(o->current < o->last && o->position >= o->files[o->current].offset + o->files[o->current].size)
+		if(next_file(o) == -1)
+			return -1;
+
+	if(o->current < o->last){
+		printf("Corrupted archive: %s is truncated\n", o->files[o->current].name);
+		return -1;
+	}
+	return 0;
+}
+
+int archive_extract(struct options opt)
+{
+	struct lz77_context *ctx = NULL;
+	struct archive_table table;
+	struct archive_output out;
+	struct bitfile *b_file;
+	struct lz77_stats stats;
+	struct lz77_stats *p_stats = NULL;
+	uint64_t expected, wanted_end, content_end = 0;
+	int fd = -1;
+	int first, from, k, i, ret = -1;
+
+	memset(&table, 0, sizeof(table));
+	memset(&out, 0, sizeof(out));
+	out.fd = -1;
+	out.test = opt.mode == TEST;
+
+	fd = open(opt.file_in, O_RDONLY);
+	if(fd == -1)
+		return -1;
+	if(read_table(fd, &table) == -1)
+		goto end;
+
+	if(table.n_files > 0)
+		content_end = table.files[table.n_files-1].offset + table.files[table.n_files-1].size;
+	out.files = table.files;
+	out.last = table.n_files;
+	if(opt.extract != NULL){
+		for(i = 0; i < table.n_files; i++)
+			if(strcmp(table.files[i].name, opt.extract) == 0)
+				break;
+		if(i == table.n_files){
+			printf("ERROR!!! %s isn't in the archive\n", opt.extract);
+			goto end;
+		}
+		out.current = i;
+		out.last = i + 1;
+		out.single = 1;
+	}
+
+	ctx = lz77_context_create(DECOMPRESSION, MAX_WINDOW_LEN);
+	if(ctx == NULL)
+		goto end;
+
+	print_options(opt);
+	if(opt.verbose || opt.stats_file != NULL){
+		bzero(&stats, sizeof(stats));
+		p_stats = &stats;
+	}
+	opt.quiet = 1;
+
+	if(opt.extract != NULL && !out.test){
+		if(opt.file_out == NULL){
+			fflush(stdout);
+			out.fd = opt.stdout_fd;
+		}else{
+			out.fd = open(opt.file_out, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+			if(out.fd == -1)
+				goto end;
+		}
+	}
+
+	// the nearest restart point before the first file wanted, all the
+	// streams are decoded to test the archive
+	first = 0;
+	wanted_end = 0;
+	if(out.last > out.current){
+		struct archive_file *f = &table.files[out.last - 1];
+
+		wanted_end = f->offset + f->size;
+		for(k = 0; k < table.n_restarts; k++)
+			if(table.restarts[k].offset <= table.files[out.current].offset)
+				first = k;
+	}
+	out.position = table.restarts[first].offset;
+	from = out.current;
+
+	ret = 0;
+	for(k = first; k < table.n_restarts; k++){
+		if(opt.extract != NULL && out.position >= wanted_end)
+			break;
+
+		if(lseek(fd, table.restarts[k].stream, SEEK_SET) == -1){
+			ret = -1;
+			break;
+		}
+		b_file = bit_fdopen_at(fd, BIT_RD, CONTEXT_BUFSIZE, ctx->bitfile);
+		ret = decode_stream(ctx, opt, b_file, &(struct lz77_output){ archive_write, &out }, p_stats);
+		bit_close(b_file);
+		if(ret == -1)
+			break;
+
+		expected = k + 1 < table.n_restarts ? table.restarts[k+1].offset : content_end;
+		if(out.position != expected){
+			printf("Corrupted archive: the stream %d has %llu bytes instead of %llu\n", k,
+			       (unsigned long long)(out.position - table.restarts[k].offset),
+			       (unsigned long long)(expected - table.restarts[k].offset));
+			ret = -1;
+			break;
+		}
+	}
+	if(ret != -1)
+		ret = finish_output(&out);
+
+	if(ret != -1 && out.test){
+		if(opt.verbose)
+			for(i = from; i < out.last; i++)
+				printf("%12llu %s\n", (unsigned long long)table.files[i].size, table.files[i].name);
+		printf("%s: OK\n", opt.file_in);
+	}
+	if(ret != -1 && p_stats != NULL && stats_report(&stats, 0, opt.verbose, opt.stats_file) == -1)
+		ret = -1;
+
+end:
+	// the standard output isn't closed, a partial file is removed so it
+	// can't be taken for a good one
+	if(out.fd != -1 && !(out.single && opt.file_out == NULL)){
+		close(out.fd);
+		if(ret == -1)
+			remove(out.single ? opt.file_out : table.files[out.current].name);
+	}
+	if(fd != -1)
+		close(fd);
+	lz77_context_free(ctx);
+	free_table(&table);
+	return ret;
+}
@@ -0,0 +1,316 @@
+/**
+ * @file batch.c
+ *
+ * The workers take the files from a shared index protected by a mutex, the
+ * files are many and small so the cost of the lock doesn't matter. Each
+ * worker keeps its own counters, they are added up after the join.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "../include/batch.h"
+#include "../include/lz77.h"
+#include "../include/trace.h"
+
+/**
+ * State shared by the workers, only next is written (under lock).
+ */
+struct batch{
+	struct options opt;
+	char **files;
+	int n_files;
+	int next;	// next file to do
+	pthread_mutex_t lock;
+	struct lz77_pool pool;
+	struct lz77_preload *preload;	// NULL in decompression
+};
+
+/**
+ * A worker thread and its counters.
+ */
+struct worker{
+	pthread_t thread;
+	struct batch *batch;
+	uint64_t files;
+	uint64_t errors;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+};
+
+
+/**
+ * Return the size of a file, 0 if it can't be read.
+ */
+static uint64_t file_size(const char *filename)
+{
+	struct stat st;
+
+	if(stat(filename, &st) == -1)
+		return 0;
+	return st.st_size;
+}
+
+/**
+ * Return the name of the output of file_in (it must be freed), NULL if it
+ * can't be made. In test mode there isn't an output and it returns file_in.
+ */
+static char *output_name(const struct options *opt, const char *file_in)
+{
+	size_t len = strlen(file_in);
+	size_t suffix = strlen(BATCH_SUFFIX);
+	char *name;
+
+	if(opt->mode == COMPRESSION){
+		name = malloc(len + suffix + 1);
+		if(name == NULL)
+			return NULL;
+		memcpy(name, file_in, len);
+		memcpy(name + len, BATCH_SUFFIX, suffix + 1);
+		return name;
+	}
+
+	if(opt->mode == TEST)
+		return strdup(file_in);
+
+	if(len <= suffix || strcmp(file_in + len - suffix, BATCH_SUFFIX) != 0){
+		printf("ERROR!!! %s doesn't end with %s\n", file_in, BATCH_SUFFIX);
+		return NULL;
+	}
+	name = strndup(file_in, len - suffix);
+	return name;
+}
+
+/**
+ * Compress, decompress or test a file with a context of the pool.
+ *
+ * @return	0 if success, -1 otherwise
+ */
+static int batch_file(struct worker *worker, char *file_in)
+{
+	struct batch *b = worker->batch;
+	struct options opt = b->opt;
+	struct lz77_context *ctx;
+	char *file_out;
+	int ret;
+
+	file_out = output_name(&opt, file_in);
+	if(file_out == NULL)
+		return -1;
+
+	// the statistics of each file would be mixed, only a line is printed
+	opt.file_in = file_in;
+	opt.file_out = opt.mode == TEST ? NULL : file_out;
+	opt.verbose = 0;
+	opt.stats_file = NULL;
+	opt.quiet = 1;
+	// an existing output isn't overwritten, also if two workers (or two
+	// batches) have the same output
+	opt.exclusive = 1;
+	// the workers already overlap the I/O of a file with the others
+	opt.pipeline = 0;
+
+	ctx = lz77_pool_get(&b->pool);
+	if(ctx == NULL){
+		free(file_out);
+		return -1;
+	}
+	ctx->preload = b->preload;
+
+	if(opt.mode == COMPRESSION)
+		ret = encode_context(ctx, opt);
+	else
+		ret = decode_context(ctx, opt);
+	lz77_pool_put(&b->pool, ctx);
+
+	if(ret == -1 && errno == EEXIST && opt.mode != TEST){
+		printf("ERROR!!! %s already exists, %s is skipped\n", file_out, file_in);
+	}else if(ret == -1){
+		printf("ERROR!!! %s can't be %s\n", file_in,
+		       opt.mode == COMPRESSION ? "compressed" : opt.mode == TEST ? "tested" : "decompressed");
+	}else{
+		uint64_t in = file_size(file_in);
+		uint64_t out = opt.mode == TEST ? 0 : file_size(file_out);
+
+		worker->bytes_in += in;
+		worker->bytes_out += out;
+		if(b->opt.verbose && opt.mode != TEST)
+			printf("%s -> %s : %llu -> %llu bytes\n", file_in, file_out,
+			       (unsigned long long)in, (unsigned long long)out);
+	}
+
+	free(file_out);
+	return ret;
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *worker = arg;
+	struct batch *b = worker->batch;
+	int i;
+
+	trace_thread_name("batch worker");
+
+	for(;;){
+		pthread_mutex_lock(&b->lock);
+		i = b->next++;
+		pthread_mutex_unlock(&b->lock);
+		if(i >= b->n_files)
+			break;
+
+		worker->files++;
+		if(batch_file(worker, b->files[i]) == -1)
+			worker->errors++;
+	}
+
+	return NULL;
+}
+
+int batch_read_list(char ***files)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	char **list = NULL;
+	int n = 0, max = 0;
+
+	while( (len = getline(&line, &size, stdin)) != -1 ){
+		while(len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+			line[--len] = '\0';
+		if(len == 0)
+			continue;
+
+		if(n == max){
+			char **bigger;
+
+			max = max == 0 ? 256 : max * 2;
+			bigger = realloc(list, max * sizeof(char*));
+			if(bigger == NULL)
+				goto error;
+			list = bigger;
+		}
+		list[n] = strdup(line);
+		if(list[n] == NULL)
+			goto error;
+		n++;
+	}
+	free(line);
+
+	*files = list;
+	return n;
+
+error:
+	while(n > 0)
+		free(list[--n]);
+	free(list);
+	free(line);
+	return -1;
+}
+
+
+int batch(struct options opt, char **files, int n_files)
+{
+	struct batch b;
+	struct worker *workers;
+	struct timespec start, end;
+	uint64_t n = 0, errors = 0, bytes_in = 0, bytes_out = 0;
+	char **list = NULL;
+	double seconds;
+	int jobs, started;
+	int i, ret = 0;
+
+	if(n_files == 0){
+		n_files = batch_read_list(&list);
+		if(n_files == -1)
+			return -1;
+		files = list;
+	}
+	if(n_files == 0){
+		printf("No files to %s\n", opt.mode == COMPRESSION ? "compress" : opt.mode == TEST ? "test" : "decompress");
+		return -1;
+	}
+
+	jobs = opt.jobs;
+	if(jobs == 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if(jobs > n_files)
+		jobs = n_files;
+	if(jobs < 1)
+		jobs = 1;
+
+	memset(&b, 0, sizeof(b));
+	b.opt = opt;
+	b.files = files;
+	b.n_files = n_files;
+	pthread_mutex_init(&b.lock, NULL);
+	workers = calloc(jobs, sizeof(struct worker));
+	if(workers == NULL){
+		ret = -1;
+		goto end;
+	}
+
+	if(opt.mode == COMPRESSION){
+		b.preload = encode_preload(opt);
+		if(b.preload == NULL){
+			ret = -1;
+			goto end;
+		}
+		ret = lz77_pool_init(&b.pool, COMPRESSION, opt.window_len, jobs);
+	}else{
+		// the window length is in the compressed files
+		ret = lz77_pool_init(&b.pool, DECOMPRESSION, MAX_WINDOW_LEN, jobs);
+	}
+	if(ret == -1){
+		lz77_preload_free(b.preload);
+		goto end;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(started = 0; started < jobs; started++){
+		workers[started].batch = &b;
+		// if a thread can't be created the ones already started do all the files
+		if(pthread_create(&workers[started].thread, NULL, worker_main, &workers[started]) != 0)
+			break;
+	}
+	if(started == 0){
+		worker_main(&workers[0]);
+		jobs = 1;
+	}else{
+		jobs = started;
+		for(i = 0; i < jobs; i++)
+			pthread_join(workers[i].thread, NULL);
+	}
+	for(i = 0; i < jobs; i++){
+		n += workers[i].files;
+		errors += workers[i].errors;
+		bytes_in += workers[i].bytes_in;
+		bytes_out += workers[i].bytes_out;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	lz77_pool_destroy(&b.pool);
+	lz77_preload_free(b.preload);
+
+	printf("Batch : %llu files, %llu errors, %d threads, %.3f s\n",
+	       (unsigned long long)n, (unsigned long long)errors, jobs, seconds);
+	printf("Read : %llu bytes, %.2f MB/s\n", (unsigned long long)bytes_in,
+	       seconds > 0 ? bytes_in / seconds / 1e6 : 0);
+	if(opt.mode != TEST)
+		printf("Written : %llu bytes, %.2f MB/s\n", (unsigned long long)bytes_out,
+		       seconds > 0 ? bytes_out / seconds / 1e6 : 0);
+	if(errors > 0)
+		ret = -1;
+
+end:
+	free(workers);
+	pthread_mutex_destroy(&b.lock);
+	if(list != NULL){
+		for(i = 0; i < n_files; i++)
+			free(list[i]);
+		free(list);
+	}
+	return ret;
+}
@@ -67,7 +67,9 @@
  * @author Pischedda Alessandro
  */
 
+#include <string.h>
 #include "../include/bitio.h"
+#include "../include/trace.h"
 
 /** @struct bitfile
  *
@@ -82,51 +84,112 @@ struct bitfile{
 	int w_inizio;
 	int ofs;	// offset where begin the data in the buffer
 	int n_bits;
+	int allocated;	// the structure was allocated by bit_open()
+	int keep_fd;	// fd was given by the caller (bit_fdopen_at()), it isn't closed
+	bit_io io;	// if it isn't NULL it's used instead of read()/write() on fd
+	int eof;	// a read returned 0, bit_peek() doesn't try again
+	void *io_arg;	// first argument of io
 	char buf[0];
 };
 
+/**
+ * Return the bytes of the buffer for bufsize bits: bufsize must be a multiple
+ * of 8 and in the range MIN/MAX
+ */
+static int buffer_bytes(int bufsize){
+
+	int n_bytes = bufsize/8;
+
+	if( n_bytes < MIN_SIZE )
+		n_bytes = MIN_SIZE;
+	else if( n_bytes > MAX_SIZE )
+		n_bytes = MAX_SIZE;
+	return n_bytes;
+}
+
+size_t bit_size(int bufsize){
+
+	return sizeof(struct bitfile) + buffer_bytes(bufsize);
+}
+
 struct bitfile* bit_open(const char *filename, int mode, int bufsize ){
 
-	int fd;
-	int n_bytes;
-	struct bitfile *bit_fp = NULL;
+	struct bitfile *bit_fp;
+	void *mem;
 
-	if( filename == NULL || filename == '\0' || (mode != BIT_RD && mode != BIT_WR) ){
-		errno = EINVAL;
+	mem = malloc( bit_size(bufsize) );
+	if(mem == NULL)
 		return NULL;
-	}
 
+	bit_fp = bit_open_at(filename, mode, bufsize, mem);
+	if(bit_fp == NULL)
+		free(mem);
+	else
+		bit_fp->allocated = 1;
 
-	// bufsize must be a multiple of 8 and in the range MIN/MAX
-	n_bytes = bufsize/8;
-	if( n_bytes < MIN_SIZE )
-	{
-		n_bytes = MIN_SIZE;
-	}else{
-		if( n_bytes > MAX_SIZE )
-			n_bytes = MAX_SIZE;
+	return bit_fp;
+}
+
+struct bitfile* bit_open_at(const char *filename, int mode, int bufsize, void *mem ){
+
+	int fd;
+	struct bitfile *bit_fp;
+
+	if( filename == NULL || *filename == '\0' || (mode != BIT_RD && mode != BIT_WR) || mem == NULL ){
+		errno = EINVAL;
+		return NULL;
 	}
 
-	fd = open(filename,mode==0?O_RDONLY:(O_WRONLY|O_CREAT), S_IRWXU);
+	fd = open(filename,mode==0?O_RDONLY:(O_WRONLY|O_CREAT|O_TRUNC), S_IRWXU);
 
 	if( fd == -1)
 		return NULL;
-	
-	/* calloc initialize the structure with zeros */
-	bit_fp = (struct bitfile*)calloc( 1, sizeof(struct bitfile) + n_bytes );
 
-	if(bit_fp == NULL){
-		close(fd);
+	bit_fp = bit_fdopen_at(fd, mode, bufsize, mem);
+	bit_fp->keep_fd = 0;
+
+	return bit_fp;
+}
+
+struct bitfile* bit_open_io_at(bit_io io, void *arg, int mode, int bufsize, void *mem ){
+
+	struct bitfile *bit_fp;
+
+	if( io == NULL ){
+		errno = EINVAL;
+		return NULL;
 	}
-	else
-	{
-		// fill the bitfile structure
-		bit_fp->fd = fd;
-		bit_fp->mode = mode;
-		bit_fp->bufsize = n_bytes*8;
-		//all other parameters are initialized to zero thanks to calloc()
+
+	// fd isn't used, 0 only passes the check of bit_fdopen_at()
+	bit_fp = bit_fdopen_at(0, mode, bufsize, mem);
+	if(bit_fp == NULL)
+		return NULL;
+	bit_fp->fd = -1;
+	bit_fp->io = io;
+	bit_fp->io_arg = arg;
+
+	return bit_fp;
+}
+
+struct bitfile* bit_fdopen_at(int fd, int mode, int bufsize, void *mem ){
+
+	int n_bytes;
+	struct bitfile *bit_fp = mem;
+
+	if( fd < 0 || (mode != BIT_RD && mode != BIT_WR) || mem == NULL ){
+		errno = EINVAL;
+		return NULL;
 	}
 
+	n_bytes = buffer_bytes(bufsize);
+
+	// fill the bitfile structure, all other parameters start from zero
+	memset(bit_fp, 0, sizeof(struct bitfile) + n_bytes);
+	bit_fp->fd = fd;
+	bit_fp->mode = mode;
+	bit_fp->bufsize = n_bytes*8;
+	bit_fp->keep_fd = 1;
+
 	return bit_fp;
 }
 
@@ -192,12 +255,228 @@ int bit_write( struct bitfile *fd, const char *buf, int n_bits, int ofs)
 
 
 
+/**
+ * Call read() or the io function of fd, retrying if interrupted.
+ */
+static int read_some(struct bitfile *fd, char *buf, int n){
+
+	int ret;
+
+	do{
+		if(fd->io != NULL)
+			ret = fd->io(fd->io_arg, buf, n);
+		else
+			ret = read(fd->fd, buf, n);
+	}while(ret == -1 && errno == EINTR);
+	return ret;
+}
+
+/**
+ * Write n bytes of buf in the file of fp: on a pipe or a socket write() can
+ * write less bytes than requested.
+ *
+ * @return	0 if success, -1 otherwise and errno is set
+ */
+static int write_all(struct bitfile *fp, char *buf, int n){
+
+	int ret;
+
+	while(n > 0){
+		if(fp->io != NULL)
+			ret = fp->io(fp->io_arg, buf, n);
+		else
+			ret = write(fp->fd, buf, n);
+		if(ret == -1){
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		n -= ret;
+	}
+	return 0;
+}
+
+/**
+ * Move the bytes not yet read at the start of the buffer and read after them.
+ *
+ * @return	the number of bytes read, 0 at the end of the file, -1 in case of error
+ */
+static int refill(struct bitfile *fd){
+
+	int first, bytes, ret;
+	uint64_t t;
+
+	first = fd->n_bits == 0 ? 0 : fd->w_inizio;
+	bytes = (fd->ofs + fd->n_bits + 7) / 8;
+	memmove(fd->buf, fd->buf + first, bytes);
+	fd->w_inizio = 0;
+	t = trace_begin();
+	ret = read_some(fd, fd->buf + bytes, fd->bufsize/8 - bytes);
+	trace_add(TRACE_FLUSH, t);
+	if(ret == -1)
+		return -1;
+	if(ret == 0)
+		fd->eof = 1;
+	fd->n_bits += ret * 8;
+	return ret;
+}
+
+int bit_peek(struct bitfile *fd, uint64_t *bits){
+
+	int bytes, ret, i;
+	uint64_t word;
+
+	// less than 8 bytes left: move them at the start and fill the buffer
+	if( fd->ofs + fd->n_bits < 64 && !fd->eof && refill(fd) == -1 )
+		return -1;
+
+	// the bytes from the current one, the first is the least significant
+	bytes = (fd->ofs + fd->n_bits + 7) / 8;
+	if(bytes >= 8){
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		memcpy(&word, fd->buf + fd->w_inizio, 8);
+#else
+		for(word = 0, i = 7; i >= 0; i--)
+			word = word << 8 | (uint8_t)fd->buf[fd->w_inizio + i];
+#endif
+		bytes = 8;
+	}else{
+		for(word = 0, i = bytes - 1; i >= 0; i--)
+			word = word << 8 | (uint8_t)fd->buf[fd->w_inizio + i];
+	}
+
+	*bits = word >> fd->ofs;
+	ret = bytes * 8 - fd->ofs;
+	return ret < fd->n_bits ? ret : fd->n_bits;
+}
+
+void bit_skip(struct bitfile *fd, int n){
+
+	fd->ofs += n;
+	fd->w_inizio += fd->ofs >> 3;
+	fd->ofs &= 7;
+	fd->n_bits -= n;
+}
+
+int bit_bytes(struct bitfile *fd, const unsigned char **p, int min){
+
+	if( fd->mode != BIT_RD || fd->ofs != 0 || min > fd->bufsize/8 ){
+		errno = EINVAL;
+		return -1;
+	}
+
+	// a read of a pipe can give less bytes than the ones asked
+	while( fd->n_bits/8 < min && !fd->eof )
+		if( refill(fd) == -1 )
+			return -1;
+
+	*p = (const unsigned char*)fd->buf + fd->w_inizio;
+	return fd->n_bits/8;
+}
+
+
+/**
+ * Write the complete bytes of the buffer and move the last one, partially
+ * written, at the start.
+ */
+static int flush_bytes(struct bitfile *fp){
+
+	if(fp->w_inizio == 0)
+		return 0;
+	if(write_all(fp, fp->buf, fp->w_inizio) == -1)
+		return -1;
+	if(fp->ofs != 0)
+		fp->buf[0] = fp->buf[fp->w_inizio];
+	fp->w_inizio = 0;
+	fp->n_bits = fp->ofs;
+	return 0;
+}
+
+int bit_put(struct bitfile *fd, uint64_t bits, int n){
+
+	uint64_t word;
+	char bytes[8];
+	int i;
+
+	if( fd->mode != BIT_WR || n < 0 || n > 57 ){
+		errno = EINVAL;
+		return -1;
+	}
+	bits &= ((uint64_t)1 << n) - 1;
+
+	// room for a store of 8 bytes
+	if( fd->w_inizio + 8 > fd->bufsize/8 && flush_bytes(fd) == -1 )
+		return -1;
+
+	if( fd->w_inizio + 8 > fd->bufsize/8 ){
+		// too small buffer, bit by bit
+		for(i = 0; i < 8; i++)
+			bytes[i] = bits >> (8 * i);
+		return bit_write(fd, bytes, n, 0);
+	}
+
+	// the bits already written in the current byte and the new ones after them
+	word = ((uint8_t)fd->buf[fd->w_inizio] & ((1 << fd->ofs) - 1)) | bits << fd->ofs;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	memcpy(fd->buf + fd->w_inizio, &word, 8);
+#else
+	for(i = 0; i < 8; i++)
+		fd->buf[fd->w_inizio + i] = word >> (8 * i);
+#endif
+
+	fd->ofs += n;
+	fd->w_inizio += fd->ofs >> 3;
+	fd->ofs &= 7;
+	fd->n_bits += n;
+	return n;
+}
+
+int bit_align(struct bitfile *fd){
+
+	int pad = (8 - fd->ofs) & 7;
+
+	if(pad == 0)
+		return 0;
+	if(fd->mode == BIT_WR)
+		return bit_put(fd, 0, pad);
+	bit_skip(fd, pad);
+	return pad;
+}
+
+int bit_write_bytes(struct bitfile *fd, const char *buf, int n){
+
+	int room, done = 0;
+
+	if( fd->mode != BIT_WR || fd->ofs != 0 || n < 0 ){
+		errno = EINVAL;
+		return -1;
+	}
+
+	while(done < n){
+		room = fd->bufsize/8 - fd->w_inizio;
+		if(room == 0){
+			if(flush_bytes(fd) == -1)
+				return -1;
+			continue;
+		}
+		if(room > n - done)
+			room = n - done;
+		memcpy(fd->buf + fd->w_inizio, buf + done, room);
+		fd->w_inizio += room;
+		fd->n_bits += room * 8;
+		done += room;
+	}
+	return n;
+}
+
 int bit_read(struct bitfile *fd,char* buf, int n_bits, int ofs){
 
 	uint8_t w_mask, mask;
 	// int pos;
 	int ret, bits_read;
 	char *p = buf;
+	uint64_t t;
 
 	/* Check the argouments*/
 	if( (fd == NULL ) || (buf == NULL) || (ofs < 0) || (ofs > 7) || ( fd->mode != BIT_RD ) || ( n_bits < 0) ){
@@ -216,7 +495,9 @@ int bit_read(struct bitfile *fd,char* buf, int n_bits, int ofs){
 		{
 			fd->ofs = 0;	// first usefull bit 
 			fd->w_inizio = 0;
-			ret = read(fd->fd, fd->buf ,fd->bufsize/8);
+			t = trace_begin();
+			ret = read_some(fd, fd->buf, fd->bufsize/8);
+			trace_add(TRACE_FLUSH, t);
 
 			mask = 1;
 			// an error occur in the read operation above
@@ -263,6 +544,7 @@ int bit_read(struct bitfile *fd,char* buf, int n_bits, int ofs){
 int bit_flush(struct bitfile *fp){
 
 	int ret, bytes_left,bits_left;
+	uint64_t t;
 
 	if ( (fp == NULL) || ( fp->mode != BIT_WR ) ){
 		errno = EINVAL;	
@@ -271,10 +553,11 @@ int bit_flush(struct bitfile *fp){
 
 	bytes_left = fp->n_bits/8;
 	bits_left = fp->n_bits%8;
+	t = trace_begin();
 
 	// write bytes_left from the top of the buffer
 	if(bytes_left){
-		ret = write(fp->fd, fp->buf, bytes_left);
+		ret = write_all(fp, fp->buf, bytes_left);
 		if(ret == -1){
 			return -1;
 		}	
@@ -288,8 +571,11 @@ int bit_flush(struct bitfile *fp){
 
 		mask = (1<<bits_left)-1;
 		last_data = fp->buf[fp->w_inizio] & mask;
-		ret = write(fp->fd, &last_data, 1);
+		ret = write_all(fp, &last_data, 1);
+		if(ret == -1)
+			return -1;
 	}
+	trace_add(TRACE_FLUSH, t);
 		
 	fp->ofs = 0;
 	fp->w_inizio = 0;
@@ -302,17 +588,21 @@ int bit_flush(struct bitfile *fp){
 
 int bit_close(struct bitfile * fp){
 
+	int ret = 0;
+
 	if(fp == NULL){
 		errno = EINVAL;
 		return -1;
 	}
 
-	if(fp->mode == BIT_WR )
-		bit_flush(fp);
+	if(fp->mode == BIT_WR && bit_flush(fp) == -1)
+		ret = -1;
 
-	close(fp->fd);
-	free(fp);
-	return 0;
+	if(!fp->keep_fd && close(fp->fd) == -1)
+		ret = -1;
+	if(fp->allocated)
+		free(fp);
+	return ret;
 }
 
 
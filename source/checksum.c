@@ -0,0 +1,106 @@
+/**
+ * @file checksum.c
+ *
+ * CRC32C implementation. The right version (SSE4.2 or table driven) is
+ * choosen only once, when the software starts, by crc32c_init().
+ *
+ * @author Pischedda Alessandro
+ */
+
+#include "../include/checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <nmmintrin.h>
+#endif
+
+#define POLY 0x82f63b78	// Castagnoli polynomial (reversed)
+
+// slicing-by-8 tables, table[0] is the classic byte table
+static uint32_t table[8][256];
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len);
+static uint32_t (*crc32c_impl)(uint32_t, const unsigned char *, size_t) = crc32c_sw;
+
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t word;
+
+	// 8 bytes for each iteration
+	while(len >= 8){
+		word = (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+		       (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+		word ^= crc;
+		crc = table[7][ word & 0xff ] ^ table[6][ (word >> 8) & 0xff ] ^
+		      table[5][ (word >> 16) & 0xff ] ^ table[4][ (word >> 24) & 0xff ] ^
+		      table[3][ (word >> 32) & 0xff ] ^ table[2][ (word >> 40) & 0xff ] ^
+		      table[1][ (word >> 48) & 0xff ] ^ table[0][ word >> 56 ];
+		p += 8;
+		len -= 8;
+	}
+
+	while(len--)
+		crc = table[0][ (crc ^ *p++) & 0xff ] ^ (crc >> 8);
+
+	return crc;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+#if defined(__x86_64__)
+	uint64_t crc64 = crc;
+	uint64_t word;
+
+	while(len >= 8){
+		__builtin_memcpy(&word, p, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		p += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)crc64;
+#endif
+	while(len--)
+		crc = _mm_crc32_u8(crc, *p++);
+
+	return crc;
+}
+#endif
+
+
+/**
+ * Build the tables of the software version and check if the processor
+ * has the crc32 instruction. It's called before main() so the tables are
+ * ready before any thread can use them.
+ */
+__attribute__((constructor))
+static void crc32c_init(void)
+{
+	uint32_t crc;
+	int i, j;
+
+	for(i = 0; i < 256; i++){
+		crc = i;
+		for(j = 0; j < 8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ POLY : crc >> 1;
+		table[0][i] = crc;
+	}
+
+	for(i = 0; i < 256; i++)
+		for(j = 1; j < 8; j++)
+			table[j][i] = table[0][ table[j-1][i] & 0xff ] ^ (table[j-1][i] >> 8);
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports("sse4.2") )
+		crc32c_impl = crc32c_hw;
+#endif
+}
+
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	return ~crc32c_impl(~crc, (const unsigned char*)buf, len);
+}
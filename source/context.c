@@ -0,0 +1,181 @@
+/**
+ * @file context.c
+ *
+ * The memory of a context is a single block (arena) divided in this way
+ *
+ *	| window | tree nodes | tree fathers | bitfile |
+ *
+ * each part is aligned to ARENA_ALIGN bytes. The decompression contexts
+ * haven't the tree.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../include/context.h"
+
+#define ARENA_ALIGN 64	// a cache line
+
+/**
+ * Take size bytes from the arena, *used is the memory already taken.
+ * With arena NULL it only computes the space needed.
+ */
+static void *arena_take(char *arena, size_t *used, size_t size)
+{
+	void *p = arena == NULL ? NULL : arena + *used;
+
+	*used += (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	return p;
+}
+
+/**
+ * Divide the arena between the parts of the context, with ctx->arena NULL
+ * it only computes the size of the arena.
+ *
+ * @return	the size of the arena
+ */
+static size_t arena_layout(struct lz77_context *ctx)
+{
+	size_t used = 0;
+	int n_nodes = ctx->window_len + 1; // plus ROOT
+
+	// the keys of the tree can read KEY_BYTES after the end of the window
+	ctx->window = arena_take(ctx->arena, &used, ctx->window_len * K + KEY_BYTES);
+	if(ctx->mode == COMPRESSION){
+		ctx->tree.nodes = arena_take(ctx->arena, &used, n_nodes * sizeof(struct Node));
+		ctx->tree.father = arena_take(ctx->arena, &used, n_nodes * sizeof(uint16_t));
+		ctx->tree.n_nodes = ctx->window_len;
+	}
+	ctx->bitfile = arena_take(ctx->arena, &used, bit_size(CONTEXT_BUFSIZE));
+
+	return used;
+}
+
+struct lz77_context *lz77_context_create(int mode, int window_len)
+{
+	struct lz77_context *ctx;
+
+	if( (mode != COMPRESSION && mode != DECOMPRESSION) || window_len <= 0 || window_len > MAX_WINDOW_LEN ){
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ctx = calloc(1, sizeof(struct lz77_context));
+	if(ctx == NULL)
+		return NULL;
+	ctx->mode = mode;
+	ctx->window_len = window_len;
+
+	ctx->arena_size = arena_layout(ctx);
+	if(posix_memalign((void**)&ctx->arena, ARENA_ALIGN, ctx->arena_size) != 0){
+		free(ctx);
+		errno = ENOMEM;
+		return NULL;
+	}
+	arena_layout(ctx);
+	lz77_context_reset(ctx);
+
+	return ctx;
+}
+
+void lz77_context_reset(struct lz77_context *ctx)
+{
+	// the same input must give the same output whatever was compressed before,
+	// the bytes after the end of the input can be read by the tree keys
+	memset(ctx->window, 0, ctx->window_len * K + KEY_BYTES);
+	if(ctx->mode == COMPRESSION)
+		empty_tree(&ctx->tree);
+}
+
+void lz77_context_free(struct lz77_context *ctx)
+{
+	if(ctx == NULL)
+		return;
+	free(ctx->arena);
+	free(ctx);
+}
+
+void lz77_preload_free(struct lz77_preload *preload)
+{
+	if(preload == NULL)
+		return;
+	lz77_context_free(preload->ctx);
+	free(preload);
+}
+
+
+int lz77_pool_init(struct lz77_pool *pool, int mode, int window_len, int n)
+{
+	int i;
+
+	if(pool == NULL || n < 0){
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(pool, 0, sizeof(struct lz77_pool));
+	pool->mode = mode;
+	pool->window_len = window_len;
+	if(pthread_mutex_init(&pool->lock, NULL) != 0)
+		return -1;
+
+	for(i = 0; i < n; i++){
+		struct lz77_context *ctx = lz77_context_create(mode, window_len);
+
+		if(ctx == NULL){
+			lz77_pool_destroy(pool);
+			return -1;
+		}
+		pool->created++;
+		lz77_pool_put(pool, ctx);
+	}
+
+	return 0;
+}
+
+struct lz77_context *lz77_pool_get(struct lz77_pool *pool)
+{
+	struct lz77_context *ctx;
+
+	pthread_mutex_lock(&pool->lock);
+	ctx = pool->free;
+	if(ctx != NULL)
+		pool->free = ctx->next;
+	else
+		pool->created++;
+	pthread_mutex_unlock(&pool->lock);
+
+	// all the contexts are in use, the new one will be given back to the pool
+	if(ctx == NULL){
+		ctx = lz77_context_create(pool->mode, pool->window_len);
+		if(ctx == NULL){
+			pthread_mutex_lock(&pool->lock);
+			pool->created--;
+			pthread_mutex_unlock(&pool->lock);
+		}
+	}
+
+	return ctx;
+}
+
+void lz77_pool_put(struct lz77_pool *pool, struct lz77_context *ctx)
+{
+	pthread_mutex_lock(&pool->lock);
+	ctx->next = pool->free;
+	pool->free = ctx;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void lz77_pool_destroy(struct lz77_pool *pool)
+{
+	struct lz77_context *ctx;
+
+	while(pool->free != NULL){
+		ctx = pool->free;
+		pool->free = ctx->next;
+		lz77_context_free(ctx);
+	}
+	pthread_mutex_destroy(&pool->lock);
+}
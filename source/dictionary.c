@@ -0,0 +1,68 @@
+/**
+ * @file dictionary.c
+ *
+ * The dictionaries are compiled into the software as const arrays. The file
+ * dictionary_data.h is generated by the Makefile from the files "it", "en"
+ * and "cc", so to add a dictionary you must add its file to the DICTIONARIES
+ * variable in the Makefile and an entry in the table below.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#include <string.h>
+#include <errno.h>
+#include "../include/dictionary.h"
+#include "../include/dictionary_data.h"
+
+#define ENTRY(name, data) { name, data, sizeof(data) }
+
+static const struct dictionary dictionaries[] = {
+	ENTRY("it", dict_it),
+	ENTRY("en", dict_en),
+	ENTRY("cc", dict_cc),
+};
+
+#define N_DICTIONARIES (int)(sizeof(dictionaries)/sizeof(dictionaries[0]))
+
+
+const struct dictionary* find_dictionary(const char *name)
+{
+	int i;
+
+	if(name == NULL){
+		errno = EINVAL;
+		return NULL;
+	}
+
+	for(i = 0; i < N_DICTIONARIES; i++)
+		if( strcmp(dictionaries[i].name, name) == 0 )
+			return &dictionaries[i];
+
+	errno = ENOENT;
+	return NULL;
+}
+
+const struct dictionary* find_dictionary_by_id(uint32_t id)
+{
+	int i;
+
+	for(i = 0; i < N_DICTIONARIES; i++)
+		if( dictionary_id(&dictionaries[i]) == id )
+			return &dictionaries[i];
+
+	errno = ENOENT;
+	return NULL;
+}
+
+uint32_t dictionary_id(const struct dictionary *dict)
+{
+	uint32_t hash = 2166136261u; // FNV offset basis
+	int i;
+
+	for(i = 0; i < dict->length; i++){
+		hash ^= dict->data[i];
+		hash *= 16777619u; // FNV prime
+	}
+
+	return hash;
+}
@@ -1,4 +1,7 @@
 #include "../include/lz77.h"
+#include "../include/checksum.h"
+#include "../include/trace.h"
+#include "../include/pipeline.h"
 #include <arpa/inet.h>
 
 int convert_data(int data, uint8_t current_order, uint8_t file_order){
@@ -15,23 +18,664 @@ int convert_data(int data, uint8_t current_order, uint8_t file_order){
 }
 
 
+/**
+ * Write n bytes in fd, write() can write less bytes than requested.
+ *
+ * @return	0 if success, -1 otherwise
+ */
+static int write_full(int fd, const unsigned char *buf, int n)
+{
+    ssize_t r;
+
+    while(n > 0){
+	r = write(fd, buf, n);
+	if(r == -1){
+	    if(errno == EINTR)
+		continue;
+	    return -1;
+	}
+	buf += r;
+	n -= r;
+    }
+    return 0;
+}
+
+/**
+ * Write function of the output of decode_context(), arg points to the file descriptor.
+ */
+static int write_fd(void *arg, const unsigned char *buf, int n)
+{
+    return write_full(*(int*)arg, buf, n);
+}
+
+/**
+ * Write in the output (if there is one) the data decoded from the last call,
+ * these are the bytes of the window from *chunk_start to data_position, and
+ * update the checksums with them.
+ *
+ * @param win		window structure
+ * @param chunk_start	position of the first byte not yet written, it's
+ *			updated to data_position
+ * @param out		output, its write is NULL in test mode
+ * @param block_crc	checksum of the current block, NULL if the file hasn't checksums
+ * @param content_crc	checksum of the whole content, NULL if the file hasn't checksums
+ *
+ * @return		0 if success, -1 otherwise
+ */
+static int flush_chunk(const struct window *win, int *chunk_start, struct lz77_output *out,
+		       uint32_t *block_crc, uint32_t *content_crc)
+{
+    int n = win->data_position - *chunk_start;
+    uint64_t t;
+
+    if(n == 0)
+	return 0;
+
+    t = trace_begin();
+
+    if(block_crc != NULL){
+	*block_crc = crc32c(*block_crc, win->window + *chunk_start, n);
+	*content_crc = crc32c(*content_crc, win->window + *chunk_start, n);
+    }
+
+    if(out->write != NULL && out->write(out->arg, win->window + *chunk_start, n) == -1)
+	return -1;
+
+    *chunk_start = win->data_position;
+    trace_end("write", t);
+    return 0;
+}
+
+/**
+ * Read a checksum from the compressed file and compare it with crc.
+ *
+ * @return 0 if they are equal, -1 otherwise
+ */
+static int check_checksum(struct bitfile *b_file, uint32_t crc, const char *what)
+{
+    uint32_t stored = 0;
+
+    if(bit_read(b_file, (char*)(&stored), 32, 0) != 32){
+	printf("Unexpected end of the compressed file\n");
+	return -1;
+    }
+
+    stored = ntohl(stored);
+    if(stored != crc){
+	printf("Checksum error in %s: expected %08x, found %08x\n", what, stored, crc);
+	return -1;
+    }
+
+    return 0;
+}
+
+
+#define TOKEN_LITERAL 0
+#define TOKEN_MATCH 1
+#define TOKEN_OTHER 2	// eof, forward, block or invalid code: the generic path decodes it
+
+/**
+ * Meaning of a value of the length field, the decode loop looks it up with
+ * the next bits_length bits of the file.
+ *  - type	TOKEN_LITERAL, TOKEN_MATCH or TOKEN_OTHER
+ *  - bits	bits of the whole token, length field and literal or position
+ *  - length	bytes added to the window
+ */
+struct token{
+    uint8_t type;
+    uint8_t bits;
+    uint16_t length;
+};
+
+/**
+ * Fill the table of the tokens, it has an entry for each value of a field of
+ * bits_length bits.
+ */
+static void build_token_table(struct token *table, int look_ah_length, int bits_length, int bits_position)
+{
+    int code;
+
+    for(code = 0; code < 1 << bits_length; code++){
+	if(code == 0){
+	    table[code].type = TOKEN_LITERAL;
+	    table[code].bits = bits_length + 8;
+	    table[code].length = 1;
+	}else if(code <= look_ah_length){
+	    table[code].type = TOKEN_MATCH;
+	    table[code].bits = bits_length + bits_position;
+	    table[code].length = code;
+	}else{
+	    table[code].type = TOKEN_OTHER;
+	    table[code].bits = bits_length;
+	    table[code].length = 0;
+	}
+    }
+}
+
+/**
+ * Copy length bytes from position (dict_position is already added) to
+ * data_position, the bytes after the end of the dictionary wrap to its start.
+ */
+static inline void copy_match(struct window *win, int position, int length)
+{
+    unsigned char *dst = win->window + win->data_position;
+    int i;
+
+    // the dictionary ends at data_position, so the bytes don't overlap
+    if(position + length <= win->data_position){
+	memcpy(dst, win->window + position, length);
+	return;
+    }
+    for(i=0;i<length; i++)
+	dst[i] = win->window[wrap(position+i, win->dict_position+win->window_length, win->dict_position) ];
+}
+
+/**
+ * If the window is full write the data decoded and move the dictionary at
+ * the start of the window.
+ *
+ * @param t_block	start of the trace span of the block, a new one starts
+ *
+ * @return		0 if success, -1 otherwise
+ */
+static int slide_window(struct window *win, int *chunk_start, struct lz77_output *out,
+			uint32_t *block_crc, uint32_t *content_crc, uint64_t *t_block)
+{
+    uint64_t t;
+
+    if( win->data_position <= win->window_length*K - win->look_ah_length )
+	return 0;
+
+    trace_block("decode block", *t_block);
+    if(flush_chunk(win, chunk_start, out, block_crc, content_crc) == -1)
+	return -1;
+
+    // I must reload the window so I've to copy the dictionary at the beggining
+    t = trace_begin();
+    memmove(win->window, win->window + win->dict_position , win->window_length);
+    trace_end("memmove", t);
+
+    // update the following data
+    win->dict_position = 0;
+    win->data_position = win->window_length*K - win->window_length;
+    *chunk_start = win->data_position;
+    *t_block = trace_begin();
+    return 0;
+}
+
+
+/**
+ * Position in the dictionary (dict_position isn't added) of a match with the
+ * distance less 1 in the position field (HEADER_BLOCK_WIDTHS). The field of
+ * corrupted data can be longer than the dictionary, then it wraps.
+ */
+static inline int distance_position(const struct window *win, int field)
+{
+    int position = win->window_length - 1 - field;
+
+    return position < 0 ? position + win->window_length : position;
+}
+
+/**
+ * What the fast path of decode_stream() needs (see decode_tokens())
+ */
+struct decode_loop{
+    struct bitfile *b_file;
+    struct window *win;
+    const struct token *table;
+    int bits_length;
+    int bits_position;
+    uint8_t byte_order;	// of the file
+    int distances;	// the position field is the distance less 1 (HEADER_BLOCK_WIDTHS)
+    struct lz77_stats *stats;
+    int *chunk_start;
+    struct lz77_output *out;
+    uint32_t *block_crc;
+    uint32_t *content_crc;
+    uint64_t *t_block;
+};
+
+/**
+ * The n least significant bits of x.
+ */
+static inline int field(uint64_t x, int n)
+{
+    return x & (((uint64_t)1 << n) - 1);
+}
+
+/**
+ * Fast path of decode_stream(): it decodes the literals and the matches whole
+ * in the peeked bits with a lookup of their length field (see struct token),
+ * and returns at the first token for the generic path: eof, forward, block,
+ * invalid code or the last bits of the file.
+ *
+ * @return	0 if the generic path must decode the next token, -1 in case of error
+ */
+static int decode_tokens(struct decode_loop *d)
+{
+    struct window *win = d->win;
+    const int token_max = d->bits_length + (d->bits_position > 8 ? d->bits_position : 8);
+    struct token tok;
+    uint64_t bits;
+    int avail, used;
+    int position;
+
+    for(;;){
+	avail = bit_peek(d->b_file, &bits);
+	if(avail == -1)
+	    return -1;
+
+	used = 0;
+	while(avail - used >= token_max){
+	    tok = d->table[field(bits >> used, d->bits_length)];
+	    if(tok.type == TOKEN_OTHER){
+		bit_skip(d->b_file, used);
+		return 0;
+	    }
+
+	    if(tok.type == TOKEN_LITERAL){
+		win->window[win->data_position] = (unsigned char)(bits >> (used + d->bits_length));
+		if(d->stats != NULL){
+		    d->stats->literals++;
+		    d->stats->literal_bytes++;
+		}
+	    }else{
+		position = field(bits >> (used + d->bits_length), d->bits_position);
+		position = convert_data(position, LITTLE_EN, d->byte_order);
+		if(d->distances)
+		    position = distance_position(win, position);
+		position += win->dict_position;
+		copy_match(win, position, tok.length);
+		if(d->stats != NULL){
+		    d->stats->matches++;
+		    d->stats->match_bytes += tok.length;
+		    stats_match(d->stats, tok.length, win->data_position - position);
+		}
+	    }
+	    used += tok.bits;
+	    win->data_position += tok.length;
+	    win->dict_position += tok.length;
+
+	    if(slide_window(win, d->chunk_start, d->out, d->block_crc, d->content_crc, d->t_block) == -1){
+		bit_skip(d->b_file, used);
+		return -1;
+	    }
+	}
+	bit_skip(d->b_file, used);
+
+	// the last bits of the file
+	if(used == 0)
+	    return 0;
+    }
+}
+
+
+/**
+ * Copy a stored block (see write_stored() in lz77encode.c) in the window,
+ * the padding before it is already skipped. The block can be longer than the
+ * room of the window, so it's copied in pieces and the window slides after
+ * each one.
+ * The block isn't given to splice(): it's at most 64 KiB and the bitfile (or
+ * the reader of the pipeline) has already read it, the window needs its last
+ * bytes for the next matches and the checksums need all of them.
+ *
+ * @return	0 success and -1 if something goes wrong
+ */
+static int decode_stored(struct bitfile *b_file, struct window *win, int *chunk_start, struct lz77_output *out,
+			 uint32_t *block_crc, uint32_t *content_crc, uint64_t *t_block)
+{
+    const unsigned char *p;
+    int avail, length, n;
+
+    avail = bit_bytes(b_file, &p, 2);
+    if(avail == -1)
+	return -1;
+    if(avail < 2){
+	printf("Unexpected end of the compressed file\n");
+	return -1;
+    }
+    length = p[0] | p[1] << 8;
+    bit_skip(b_file, 16);
+    if(length == 0){
+	printf("Corrupted data: empty stored block\n");
+	return -1;
+    }
+    if(win->stats != NULL){
+	win->stats->stored++;
+	win->stats->stored_bytes += length;
+    }
+
+    while(length > 0){
+	avail = bit_bytes(b_file, &p, 1);
+	if(avail == -1)
+	    return -1;
+	if(avail == 0){
+	    printf("Unexpected end of the compressed file\n");
+	    return -1;
+	}
+	// the window has room until its end
+	n = win->window_length*K - win->data_position;
+	if(n > avail)
+	    n = avail;
+	if(n > length)
+	    n = length;
+	memcpy(win->window + win->data_position, p, n);
+	bit_skip(b_file, 8 * n);
+	win->data_position += n;
+	win->dict_position += n;
+	length -= n;
+
+	if(slide_window(win, chunk_start, out, block_crc, content_crc, t_block) == -1)
+	    return -1;
+    }
+    return 0;
+}
+
+/**
+ * Copy a forward match: the bytes at distance d from data_position, that are
+ * copied too while they're written, so it copies d bytes at a time.
+ */
+static inline void copy_forward(struct window *win, int d, int length)
+{
+    unsigned char *dst = win->window + win->data_position;
+    int n;
+
+    if(d == 1){ // run of a single byte
+	memset(dst, dst[-1], length);
+	return;
+    }
+    for(n = 0; n < length; n += d)
+	memcpy(dst + n, dst + n - d, length - n < d ? length - n : d);
+}
+
+/**
+ * Decode the sequences of the byte aligned format (see HEADER_BYTES in
+ * window.h) until the eof code: the fields are whole bytes read from the
+ * buffer of the bitfile and the literals are copied in the window with
+ * memcpy(), there aren't bit operations.
+ *
+ * @return	0 if success, -1 otherwise
+ */
+static int decode_sequences(struct decode_loop *d)
+{
+    // the longest sequence: token, 17 bytes of literals length, literals,
+    // position and a byte of match length
+    const int max_sequence = 1 + 17 + BYTES_MAX_LITERALS + 2 + 1;
+    struct window *win = d->win;
+    const unsigned char *p;
+    int avail, used, n;
+    int n_literals, code, length, position, forward;
+    int control;
+
+    for(;;){
+	avail = bit_bytes(d->b_file, &p, max_sequence);
+	if(avail == -1)
+	    return -1;
+	used = 0;
+	control = -1;
+
+	// the sequences whole in the buffer, less only at the end of the file
+	do{
+	    // the token and the length of the literals
+	    if(used == avail)
+		goto truncated;
+	    n_literals = p[used] >> 4;
+	    code = p[used++] & 15;
+	    if(n_literals == 15){
+		do{
+		    if(used == avail)
+			goto truncated;
+		    n_literals += p[used];
+		    if(n_literals > BYTES_MAX_LITERALS){
+			printf("Corrupted data: too many literals\n");
+			return -1;
+		    }
+		}while(p[used++] == 255);
+	    }
+	    if(avail - used < n_literals + 2)
+		goto truncated;
+
+	    // the literals, in more pieces if the window becomes full
+	    if(d->stats != NULL){
+		d->stats->literals += n_literals;
+		d->stats->literal_bytes += n_literals;
+	    }
+	    while(n_literals > 0){
+		n = win->window_length*K - win->data_position;
+		if(n > n_literals)
+		    n = n_literals;
+		memcpy(win->window + win->data_position, p + used, n);
+		used += n;
+		n_literals -= n;
+		win->data_position += n;
+		win->dict_position += n;
+		if(slide_window(win, d->chunk_start, d->out, d->block_crc, d->content_crc, d->t_block) == -1){
+		    bit_skip(d->b_file, 8 * used);
+		    return -1;
+		}
+	    }
+
+	    position = p[used] | p[used + 1] << 8;
+	    used += 2;
+	    if(position == BYTES_CONTROL){
+		if(code == BYTES_LITERALS)
+		    continue;
+		control = code;
+		break;
+	    }
+
+	    // the match
+	    length = code + BYTES_MIN_MATCH;
+	    if(code == 15){
+		do{
+		    if(used == avail)
+			goto truncated;
+		    length += p[used];
+		}while(p[used++] == 255 && length <= win->look_ah_length);
+	    }
+	    forward = position >> 15;
+	    position &= 0x7FFF;
+	    if(length > win->look_ah_length || position >= win->window_length){
+		printf("Corrupted data: invalid match\n");
+		return -1;
+	    }
+	    position += win->dict_position;
+
+	    if(forward)
+		copy_forward(win, win->data_position - position, length);
+	    else
+		copy_match(win, position, length);
+
+	    if(d->stats != NULL){
+		if(forward)
+		    d->stats->forwards++;
+		else
+		    d->stats->matches++;
+		d->stats->match_bytes += length;
+		stats_match(d->stats, length, win->data_position - position);
+	    }
+	    win->data_position += length;
+	    win->dict_position += length;
+
+	    if(slide_window(win, d->chunk_start, d->out, d->block_crc, d->content_crc, d->t_block) == -1){
+		bit_skip(d->b_file, 8 * used);
+		return -1;
+	    }
+	}while(avail - used >= max_sequence);
+	bit_skip(d->b_file, 8 * used);
+
+	if(control == -1)
+	    continue;
+
+	// eof or end of block, the checksums follow
+	if(control == BYTES_EOF){
+	    if(flush_chunk(win, d->chunk_start, d->out, d->block_crc, d->content_crc) == -1)
+		return -1;
+	    if(d->content_crc != NULL)
+		return check_checksum(d->b_file, *d->content_crc, "the whole content");
+	    return 0;
+	}
+	if(control != BYTES_BLOCK){
+	    printf("Corrupted data: invalid code %d\n", control);
+	    return -1;
+	}
+	if(d->block_crc == NULL){
+	    printf("Corrupted data: block code in a file without checksums\n");
+	    return -1;
+	}
+	if(flush_chunk(win, d->chunk_start, d->out, d->block_crc, d->content_crc) == -1 ||
+	   check_checksum(d->b_file, *d->block_crc, "a block") == -1)
+	    return -1;
+	*d->block_crc = 0;
+	if(d->stats != NULL)
+	    d->stats->blocks++;
+    }
+
+truncated:
+    printf("Unexpected end of the compressed file\n");
+    return -1;
+}
+
+
 int decode(struct options opt)
+{
+    struct lz77_context *ctx;
+    int ret;
+
+    // the window length is in the compressed file
+    ctx = lz77_context_create(DECOMPRESSION, MAX_WINDOW_LEN);
+    if(ctx == NULL)
+	return -1;
+    ret = decode_context(ctx, opt);
+    lz77_context_free(ctx);
+    return ret;
+}
+
+
+int decode_context(struct lz77_context *ctx, struct options opt)
+{
+    struct bitfile *b_file;
+    struct lz77_output out;
+    struct lz77_stats stats;
+    struct lz77_stats *p_stats = NULL;
+    struct pipeline *pipe = NULL;
+    int fd_input;
+    int fd_output = -1;
+    int ret;
+
+    if(ctx->mode != DECOMPRESSION){
+	errno = EINVAL;
+	return -1;
+    }
+
+    if(opt.file_in == NULL){
+	fd_input = STDIN_FILENO;
+    }else{
+	fd_input = open(opt.file_in, O_RDONLY);
+	if(fd_input == -1)
+	    return -1;
+    }
+
+    if(opt.mode == TEST){
+	fd_output = -1;
+    }else if( opt.file_out == NULL){
+	fd_output = opt.stdout_fd;
+    }else{
+	fd_output = open(opt.file_out, O_WRONLY|O_CREAT|(opt.exclusive ? O_EXCL : O_TRUNC), 0666);
+
+	if (fd_output == -1) {
+		if(opt.file_in != NULL)
+		    close(fd_input);
+		return -1;
+	}
+    }	
+
+    if(opt.pipeline){
+	// the reader and the writer (if there is an output) threads do the I/O
+	pipe = pipeline_start(fd_input, fd_output, opt.io_uring ? PIPELINE_URING : 0);
+	if(pipe == NULL){
+	    if(opt.file_out != NULL && fd_output != -1){
+		close(fd_output);
+		remove(opt.file_out);
+	    }
+	    if(opt.file_in != NULL)
+		close(fd_input);
+	    return -1;
+	}
+	b_file = bit_open_io_at(pipeline_bit_read, pipe, BIT_RD, CONTEXT_BUFSIZE, ctx->bitfile);
+    }else{
+	b_file = bit_fdopen_at(fd_input, BIT_RD, CONTEXT_BUFSIZE, ctx->bitfile);
+    }
+
+    if(opt.verbose || opt.stats_file != NULL){
+	bzero(&stats, sizeof(stats));
+	p_stats = &stats;
+    }
+
+    if(fd_output == -1){
+	out.write = NULL;
+    }else if(pipe != NULL){
+	out.write = pipeline_write;
+	out.arg = pipe;
+    }else{
+	out.write = write_fd;
+	out.arg = &fd_output;
+    }
+    ret = decode_stream(ctx, opt, b_file, &out, p_stats);
+
+    if(pipe != NULL && pipeline_finish(pipe) == -1 && ret != -1){
+	printf("ERROR!!! %s can't be written: %s\n",
+	       opt.file_out != NULL ? opt.file_out : "the standard output", strerror(errno));
+	ret = -1;
+    }
+
+    // close both file
+    if( fd_output != -1 && opt.file_out != NULL){
+	    close(fd_output);
+	    // if there is some error remove the output file
+	    if(ret == -1)
+		remove(opt.file_out);
+    }
+
+    bit_close(b_file);
+    if(opt.file_in != NULL)
+	close(fd_input);
+
+    if(ret == -1)
+	return ret;	
+
+    if(p_stats != NULL && stats_report(&stats, 0, opt.verbose, opt.stats_file) == -1)
+	return -1;
+
+    if(opt.mode == TEST)
+	printf("%s: OK\n", opt.file_in != NULL ? opt.file_in : "Standard Input");
+	
+    return 0;
+}
+
+
+int decode_stream(struct lz77_context *ctx, struct options opt, struct bitfile *b_file,
+		  struct lz77_output *out, struct lz77_stats *stats)
 {
     // Variables
     struct window win; 
-    FILE *file_output = NULL;
-    struct bitfile *b_file = NULL;
     struct header header;
     int i,ret;
-    int bits_length;
-    int bits_position;
+    struct token_codes codes;
     unsigned char letter;
     int length;
     int position;
-    int forward_code;
-    int eof_code; 
+    const unsigned char *bytes;
     int current_order; 
-    int pippo = 1;
+    int chunk_start;	// first byte of the window not yet written in the output
+    struct token table[1 << 9];	// bits_length is at most 9 (look ahead 255)
+    struct decode_loop loop;
+    int fast_path = 0; // decode_tokens() can be used
+    uint32_t block_crc = 0;
+    uint32_t content_crc = 0;
+    uint32_t *p_block_crc = NULL; // they point to the checksums if the file has them
+    uint32_t *p_content_crc = NULL;
+    uint64_t t, t_block; // start of the trace spans
 	
 
     /* Test for a little-endian machine */
@@ -41,17 +685,23 @@ int decode(struct options opt)
 	current_order = BIG_EN;
     #endif
 
-
-    if((pippo >> 1) == 0)
-	printf("LITTLE\n"); 
-    else 
-	printf("BIG\n");
+    if(ctx->mode != DECOMPRESSION){
+	errno = EINVAL;
+	return -1;
+    }
+    lz77_context_reset(ctx);
 
     // read the header
-    b_file = bit_open(opt.file_in,BIT_RD,128);
+    t = trace_begin();
     ret = read_header(b_file,&header);
+    trace_end("read header", t);
     if(ret == -1)
 	return -1;
+    if(header.window_len > ctx->window_len){
+	printf("The window of the compressed file (%d bytes) is bigger than the context one\n", header.window_len);
+	errno = EINVAL;
+	return -1;
+    }
     
     // Initialize window structure
     bzero(&win, sizeof(struct window));
@@ -59,96 +709,252 @@ int decode(struct options opt)
     win.window_length = header.window_len;
     win.dict_position = 0;
     win.data_position = win.window_length;
-    win.window = calloc( win.window_length*K, sizeof(char) );
+    win.window = ctx->window;
+    win.stats = stats;
     
-    // special code
-    eof_code = win.look_ah_length + 1;
-    forward_code = win.look_ah_length + 2;
+    // special codes of the whole file, or of the first block of tokens
+    set_token_codes(&codes, win.look_ah_length, number_of_bits(win.window_length), header.flags);
 
-    // plus 2 for eof_code and forward_code
-    bits_length = number_of_bits(win.look_ah_length + 2);
-    bits_position = number_of_bits(win.window_length);
+    build_token_table(table, codes.max_length, codes.bits_length, codes.bits_position);
 
-    strncpy(opt.dict, header.dict,2);
+    // the dictionary must be the same used by the encoder
+    opt.dict = find_dictionary_by_id(header.dict_id);
+    if(opt.dict == NULL){
+	printf("The dictionary used to compress this file (ID %08x) isn't available\n", header.dict_id);
+	return -1;
+    }
     opt.look_ahead_len = header.look_ah_len;
     opt.window_len = header.window_len;
+    opt.checksum = (header.flags & HEADER_CHECKSUM) != 0;
+    opt.fast_decode = (header.flags & HEADER_BYTES) != 0;
+    opt.literal_runs = (header.flags & HEADER_LITERAL_RUNS) != 0;
+    opt.block_widths = (header.flags & HEADER_BLOCK_WIDTHS) != 0;
+    if(opt.checksum){
+	p_block_crc = &block_crc;
+	p_content_crc = &content_crc;
+    }
 
     print_options(opt);
 
-    if(current_order)
-	    printf("current version : BIG ENDIAN \n");
-    else
-	    printf("current version : LITTLE ENDIAN \n");
+    if(!opt.quiet)
+	    printf("current version : %s \n", current_order ? "BIG ENDIAN" : "LITTLE ENDIAN");
+    // the messages printed until now go before the data (standard output)
+    fflush(stdout);
 
-    load_dictionary(&win, opt.dict);
+    t = trace_begin();
+    ret = load_dictionary(&win, opt.dict);
+    trace_end("load dictionary", t);
+    if(ret == -1)
+	return -1;
 
-    if( opt.file_out == NULL){
-	file_output = stdout;
-    }else{
-	file_output = fopen(opt.file_out,"w");
+    chunk_start = win.data_position;
+    t_block = trace_begin();
+
+    loop.b_file = b_file;
+    loop.win = &win;
+    loop.table = table;
+    loop.bits_length = codes.bits_length;
+    loop.bits_position = codes.bits_position;
+    loop.byte_order = header.byte_order;
+    loop.distances = opt.block_widths;
+    loop.stats = stats;
+    loop.chunk_start = &chunk_start;
+    loop.out = out;
+    loop.block_crc = p_block_crc;
+    loop.content_crc = p_content_crc;
+    loop.t_block = &t_block;
+    // the byte aligned format has its own loop
+    if(header.flags & HEADER_BYTES){
+	ret = decode_sequences(&loop);
+	trace_block("decode block", t_block);
+	return ret;
+    }
 
-	if (file_output == NULL) {
-		return -1;
-	}
-    }	
+    // the fields taken from the peeked bits are the values bit_read() stores
+    // in a little endian integer, on the other machines only the generic path
+    if(current_order == LITTLE_EN)
+	fast_path = 1;
 
     // decode cycle
     for(;;){
+
+	// fast path: the literals and the matches
+	if(fast_path && decode_tokens(&loop) == -1){
+		ret = -1;
+		break;
+	}
+
+	// generic path: the other codes and the end of the file
 	length = 0;     
 
-        ret = bit_read(b_file, (char*)(&length), bits_length , 0);
+        ret = bit_read(b_file, (char*)(&length), codes.bits_length , 0);
 
-	if(ret == -1){
-		free(win.window);	
+	if(ret != codes.bits_length){
+		printf("Unexpected end of the compressed file\n");
+		ret = -1;
 		break;
 	}
 
-	if( length == eof_code ) // end file
+	if( length == codes.eof ){ // end file
+		ret = flush_chunk(&win, &chunk_start, out, p_block_crc, p_content_crc);
+		if(ret != -1 && opt.checksum)
+			ret = check_checksum(b_file, content_crc, "the whole content");
 		break;
+	}
+
+	if( length == codes.widths ){ // widths of the next block of tokens
+		length = 0;
+		position = 0;
+		if(bit_read(b_file, (char*)(&length), 8, 0) != 8 ||
+		   bit_read(b_file, (char*)(&position), 4, 0) != 4){
+			printf("Unexpected end of the compressed file\n");
+			ret = -1;
+			break;
+		}
+		if( length > win.look_ah_length || position == 0 || position > number_of_bits(win.window_length) ){
+			printf("Corrupted data: invalid widths %d %d\n", length, position);
+			ret = -1;
+			break;
+		}
+		set_token_codes(&codes, length, position, header.flags);
+		build_token_table(table, codes.max_length, codes.bits_length, codes.bits_position);
+		loop.bits_length = codes.bits_length;
+		loop.bits_position = codes.bits_position;
+		if(stats != NULL)
+			stats->width_blocks++;
+		continue;
+	}
+
+	if( length == codes.block ){ // end of block, check its checksum
+		if( !opt.checksum ){
+			printf("Corrupted data: block code in a file without checksums\n");
+			ret = -1;
+			break;
+		}
+		ret = flush_chunk(&win, &chunk_start, out, p_block_crc, p_content_crc);
+		if(ret == -1)
+			break;
+		ret = check_checksum(b_file, block_crc, "a block");
+		if(ret == -1)
+			break;
+		block_crc = 0;
+		if(stats != NULL)
+			stats->blocks++;
+		continue;
+	}
 	
-        if( (length > 0) && (length != forward_code) ){ // wrap
+	if( length == codes.literals ){ // run of literals
+		length = 0;
+		ret = bit_read(b_file, (char*)(&length), codes.bits_length , 0);
+		if(ret != codes.bits_length){
+			printf("Unexpected end of the compressed file\n");
+			ret = -1;
+			break;
+		}
+		if( length > codes.max_length ){
+			printf("Corrupted data: invalid literal run %d\n", length);
+			ret = -1;
+			break;
+		}
+
+		// the literals are whole bytes after the padding
+		if(bit_align(b_file) == -1){
+			ret = -1;
+			break;
+		}
+		if( length == 0 ){ // stored block
+			ret = decode_stored(b_file, &win, &chunk_start, out, p_block_crc, p_content_crc, &t_block);
+			if(ret == -1)
+				break;
+			continue;
+		}
+		for(i = 0; i < length; i += ret){
+			ret = bit_bytes(b_file, &bytes, 1);
+			if(ret == -1)
+				break;
+			if(ret == 0){
+				printf("Unexpected end of the compressed file\n");
+				ret = -1;
+				break;
+			}
+			if(ret > length - i)
+				ret = length - i;
+			memcpy(win.window + win.data_position + i, bytes, ret);
+			bit_skip(b_file, 8 * ret);
+		}
+		if(ret == -1)
+			break;
+
+		if(stats != NULL){
+			stats->literal_runs++;
+			stats->literal_bytes += length;
+		}
+
+        } else if( (length > 0) && (length != codes.forward) ){ // wrap
+
+		if( length > codes.max_length ){
+			printf("Corrupted data: invalid match length %d\n", length);
+			ret = -1;
+			break;
+		}
 		
 	        position = 0;
-		ret = bit_read(b_file, (char*)(&position), bits_position , 0);
+		ret = bit_read(b_file, (char*)(&position), codes.bits_position , 0);
 		if(ret == -1)
 			break;
 		
 		position = convert_data(position, current_order, header.byte_order);
+		if(opt.block_widths)
+			position = distance_position(&win, position);
 
 		// must add the offset in the position
 		position += win.dict_position;	
 
-		// write and update
-		for(i=0;i<length; i++){
-			ret = fwrite( &win.window[wrap(position+i,win.dict_position+win.window_length,win.dict_position)], sizeof(char), 1, file_output );
-			if(ret == -1)
-				break;
-			win.window[win.data_position + i] = win.window[wrap(position+i, win.dict_position+win.window_length, win.dict_position) ];
+		// update the window, the data will be written by flush_chunk()
+		copy_match(&win, position, length);
+
+		if(stats != NULL){
+			stats->matches++;
+			stats->match_bytes += length;
+			stats_match(stats, length, win.data_position - position);
 		}
 
-	} else if (length == forward_code ){ // forward
+	} else if (length == codes.forward ){ // forward
 		// read the length
 		length = 0;
-        	ret = bit_read(b_file, (char*)(&length), bits_length , 0);
+        	ret = bit_read(b_file, (char*)(&length), codes.bits_length , 0);
 		if(ret == -1)
 			break;
 
 	        position = 0;
-		ret = bit_read(b_file, (char*)(&position), bits_position , 0);
+		ret = bit_read(b_file, (char*)(&position), codes.bits_position , 0);
 		if(ret == -1)
 			break;
 
 		position = convert_data(position, current_order, header.byte_order);
+		if(opt.block_widths)
+			position = distance_position(&win, position);
 
 		// must add the offset in the position
 		position += win.dict_position;	
 
-		// write and update the dictionary
-		for(i=0; i<length; i++){
-			ret = fwrite( &win.window[ position + i ], sizeof(char), 1, file_output );
-			if(ret == -1)
-				break;
-			win.window[win.data_position + i] = win.window[ position+i ];
+		if( length > codes.max_length || position >= win.data_position ){
+			printf("Corrupted data: invalid forward match\n");
+			ret = -1;
+			break;
+		}
+
+		// update the dictionary, the data will be written by flush_chunk()
+		if( position == win.data_position - 1 ) // run of a single byte
+			memset(win.window + win.data_position, win.window[ position ], length);
+		else
+			for(i=0; i<length; i++)
+				win.window[win.data_position + i] = win.window[ position+i ];
+
+		if(stats != NULL){
+			stats->forwards++;
+			stats->match_bytes += length;
+			stats_match(stats, length, win.data_position - position);
 		}
 		
         } else	if( length == 0 ){ //no match
@@ -158,47 +964,28 @@ int decode(struct options opt)
 			break;
 
 		win.window[win.data_position] = letter;	
-		ret = fwrite(&letter, sizeof(char), 1, file_output );
-		if(ret == -1)
-			break;
-
 		length = 1;
-        }	
-
-	win.data_position += length;
-	win.dict_position += length;	    	
 
+		if(stats != NULL){
+			stats->literals++;
+			stats->literal_bytes++;
+		}
 
-        if( win.data_position > win.window_length*K - win.look_ah_length ){
-	
-            // I must reload the window so I've to copy the dictionary at the beggining
-	    memmove(win.window, win.window + win.dict_position , win.window_length);
+        } else { // invalid code
+		printf("Corrupted data: invalid code %d\n", length);
+		ret = -1;
+		break;
+	}
 
-            // update the following data
-            win.dict_position = 0;
-            win.data_position = win.window_length*K - win.window_length;
+	win.data_position += length;
+	win.dict_position += length;	    	
 
-        }
+	ret = slide_window(&win, &chunk_start, out, p_block_crc, p_content_crc, &t_block);
+	if(ret == -1)
+	    break;
 
     }// end for(;;)
+    trace_block("decode block", t_block);
 
-    // free memory
-    free(win.window);
-
-    // close both file
-    if( opt.file_out != NULL){
-	    fclose(file_output);
-	    // if there is some error remove the output file
-	    if(ret == -1)
-		remove(opt.file_out);
-    }
-
-    bit_close(b_file);
-
-    if(ret == -1)
-	return ret;	
-	
-	
-    return 0;
+    return ret == -1 ? -1 : 0;
 }
-
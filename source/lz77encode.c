@@ -1,106 +1,710 @@
 #include "../include/lz77.h"
 #include "../include/tree.h"
+#include "../include/checksum.h"
+#include "../include/trace.h"
+#include "../include/pipeline.h"
 #include <arpa/inet.h>
 
+#define RUN_MIN 4	// shorter runs are cheaper as literals
+#define STORED_MIN 256	// shorter blocks are always searched
+#define STORED_MATCHES 32	// a block with a string already seen every 32 bytes is searched
+#define STORED_HASH_BITS 12	// entries of the hash table of incompressible()
+#define WIDTH_BLOCK_TOKENS 64	// tokens of a block with its own field widths
+
 /**
- * Search the number of character in common between s1 and s2
+ * Token of a block waiting for the widths of the block (see write_token_block()).
+ *  - type	BLOCK_LITERALS, BLOCK_MATCH or BLOCK_FORWARD
+ *  - length	length of the match or number of literals
+ *  - value	distance of the match less 1 or position of the literals in the window
+ */
+struct block_token{
+    uint8_t type;
+    uint8_t length;
+    uint16_t value;
+};
+
+#define BLOCK_LITERALS 0
+#define BLOCK_MATCH 1
+#define BLOCK_FORWARD 2
+
+/**
+ * Write a checksum in the compressed file preceded by code (block_code or nothing).
  *
- * @param tree		: tree structure
- * @param w  		: window structure
+ * @param file_out	compressed file
+ * @param code		special code to write before the checksum, -1 if there isn't
+ * @param bits_length	number of bits of the code
+ * @param crc		the checksum
  *
- * @return		: the length of the match
+ * @return		-1 if there is some error, the number of bits of the checksum otherwise
+ */
+static int write_checksum(struct bitfile *file_out, int code, int bits_length, uint32_t crc)
+{
+    int ret;
+
+    if(code != -1){
+	ret = bit_write(file_out,(char*)(&code),bits_length,0);
+	if(ret == -1)
+		return -1;
+    }
+
+    // network order like the header fields
+    crc = htonl(crc);
+    return bit_write(file_out,(char*)(&crc),32,0);
+}
+
+/**
+ * Add to p the bytes of a length that doesn't fit in the 4 bits of the token
+ * (value - 15), see HEADER_BYTES in window.h.
+ *
+ * @return	the number of bytes added
+ */
+static int length_bytes(unsigned char *p, int value)
+{
+    int n = 0;
+
+    for(value -= 15; value >= 255; value -= 255)
+	p[n++] = 255;
+    p[n++] = value;
+    return n;
+}
+
+/**
+ * Write a sequence of the byte aligned format (see HEADER_BYTES in window.h):
+ * the literals and a match, or a control code if position is BYTES_CONTROL.
+ *
+ * @param file_out	compressed file
+ * @param literals	literals of the sequence, at most BYTES_MAX_LITERALS
+ * @param n_literals	number of literals
+ * @param position	position of the match with the forward bit, or BYTES_CONTROL
+ * @param length	length of the match, or the control code
+ * @param stats		counters to update, NULL if they aren't needed
+ *
+ * @return		-1 if there is some error, 0 otherwise
+ */
+static int write_sequence(struct bitfile *file_out, const unsigned char *literals, int n_literals,
+			  int position, int length, struct lz77_stats *stats)
+{
+    unsigned char head[2 + BYTES_MAX_LITERALS / 255];
+    unsigned char tail[4];
+    int n_head = 1, n_tail = 2;
+    int code = position == BYTES_CONTROL ? length : length - BYTES_MIN_MATCH;
+
+    head[0] = (n_literals < 15 ? n_literals : 15) << 4 | (code < 15 ? code : 15);
+    if(n_literals >= 15)
+	n_head += length_bytes(head + 1, n_literals);
+    tail[0] = position & 0xff;
+    tail[1] = position >> 8;
+    if(code >= 15)
+	n_tail += length_bytes(tail + 2, code);
+
+    if(bit_write_bytes(file_out, (char*)head, n_head) == -1 ||
+       bit_write_bytes(file_out, (const char*)literals, n_literals) == -1 ||
+       bit_write_bytes(file_out, (char*)tail, n_tail) == -1)
+	return -1;
+
+    if(stats != NULL){
+	stats->bits_length += 8 * (n_head + n_tail - 2);
+	if(position == BYTES_CONTROL)
+	    stats->bits_code += 16;
+	else
+	    stats->bits_position += 16;
+    }
+    return 0;
+}
+
+/**
+ * Write the literals waiting for a match (HEADER_LITERAL_RUNS): a run is the
+ * literal run code, the number of literals in a length field, the padding to
+ * the next byte and the literals, written as bytes. If they are too few to
+ * pay the code, the length and the padding there is a token for each one.
+ *
+ * @param file_out	compressed file
+ * @param literals	the literals, at most look_ah_length
+ * @param n		number of literals
+ * @param literals_code	code of a literal run
+ * @param bits_length	bits of a length field
+ * @param stats		counters to update, NULL if they aren't needed
+ *
+ * @return		-1 if there is some error, 0 otherwise
+ */
+static int write_literals(struct bitfile *file_out, const unsigned char *literals, int n,
+			  int literals_code, int bits_length, struct lz77_stats *stats)
+{
+    int i, pad = 0;
+
+    // n tokens cost n * (bits_length + 8) bits, a run 2 * bits_length + n * 8
+    // and at most 7 bits of padding
+    if(n * bits_length <= 2 * bits_length + 7){
+	for(i = 0; i < n; i++)
+	    if(bit_put(file_out, (uint64_t)literals[i] << bits_length, bits_length + 8) == -1)
+		return -1;
+	if(stats != NULL){
+	    stats->literals += n;
+	    stats->bits_length += n * bits_length;
+	}
+    }else{
+	if(bit_put(file_out, literals_code | (uint64_t)n << bits_length, 2 * bits_length) == -1 ||
+	   (pad = bit_align(file_out)) == -1 ||
+	   bit_write_bytes(file_out, (const char*)literals, n) == -1)
+	    return -1;
+	if(stats != NULL){
+	    stats->literal_runs++;
+	    stats->bits_length += bits_length;
+	    stats->bits_code += bits_length + pad;
+	}
+    }
+
+    if(stats != NULL){
+	stats->literal_bytes += n;
+	stats->bits_literal += 8 * n;
+    }
+    return 0;
+}
+
+/**
+ * Write a stored block (HEADER_LITERAL_RUNS): the literal run code with 0
+ * literals, the padding to the next byte, the length of the block in 2 bytes
+ * little endian and the bytes as they are.
+ *
+ * @param file_out	compressed file
+ * @param data		bytes of the block
+ * @param n		length of the block, less than 65536
+ * @param literals_code	code of a literal run
+ * @param bits_length	bits of a length field
+ * @param stats		counters to update, NULL if they aren't needed
+ *
+ * @return		-1 if there is some error, 0 otherwise
+ */
+static int write_stored(struct bitfile *file_out, const unsigned char *data, int n,
+			int literals_code, int bits_length, struct lz77_stats *stats)
+{
+    unsigned char head[2];
+    int pad;
+
+    head[0] = n & 0xff;
+    head[1] = n >> 8;
+    if(bit_put(file_out, literals_code, 2 * bits_length) == -1 ||
+       (pad = bit_align(file_out)) == -1 ||
+       bit_write_bytes(file_out, (char*)head, 2) == -1 ||
+       bit_write_bytes(file_out, (const char*)data, n) == -1)
+	return -1;
+
+    if(stats != NULL){
+	stats->stored++;
+	stats->stored_bytes += n;
+	stats->bits_length += bits_length;
+	stats->bits_code += bits_length + pad + 16;
+	stats->bits_literal += 8 * n;
+    }
+    return 0;
+}
+
+/**
+ * Return 1 if the last token is a run of literals that can take the next
+ * one: literals waiting in the buffer (n_literals) or the last token of the
+ * block (block_widths).
+ */
+static inline int literals_open(int n_literals, const struct block_token *tokens, int n_tokens)
+{
+    return n_literals > 0 || (n_tokens > 0 && tokens[n_tokens - 1].type == BLOCK_LITERALS);
+}
+
+/**
+ * Flags of the header that change the codes of the bit format.
+ */
+static inline int stream_flags(const struct options *opt)
+{
+    return (opt->literal_runs ? HEADER_LITERAL_RUNS : 0) | (opt->block_widths ? HEADER_BLOCK_WIDTHS : 0);
+}
+
+/**
+ * Write a block of tokens with the narrowest fields for them: the widths code
+ * (with the current widths) and the new widths, then the tokens. If the
+ * current widths are enough for the tokens and the new ones would save less
+ * than the widths code, the tokens keep the current ones.
+ *
+ * @param file_out	compressed file
+ * @param w		window, it has the literals of the tokens
+ * @param tokens	tokens of the block
+ * @param n		number of tokens
+ * @param codes		current codes, they're updated with the ones of the block
+ * @param opt		options of the stream
+ * @param stats		counters to update, NULL if they aren't needed
+ *
+ * @return		-1 if there is some error, 0 otherwise
  */
-struct match find_match(struct Node *tree, struct window w);
+static int write_token_block(struct bitfile *file_out, const struct window *w, const struct block_token *tokens,
+			     int n, struct token_codes *codes, const struct options *opt, struct lz77_stats *stats)
+{
+    int i, j, bits;
+    int max_length = 0, max_distance = 0;
+    int length_fields = 0, position_fields = 0;
+    struct token_codes block;
+    uint64_t token;
+
+    // the literals are single tokens without the runs, their count isn't a field
+    for(i = 0; i < n; i++){
+	if(tokens[i].type != BLOCK_LITERALS){
+	    if(tokens[i].value > max_distance)
+		max_distance = tokens[i].value;
+	    length_fields += tokens[i].type == BLOCK_FORWARD ? 2 : 1;
+	    position_fields++;
+	}else if(!opt->literal_runs){
+	    length_fields += tokens[i].length;
+	    continue;
+	}else{
+	    length_fields += 2;
+	}
+	if(tokens[i].length > max_length)
+	    max_length = tokens[i].length;
+    }
+    set_token_codes(&block, max_length, number_of_bits(max_distance), stream_flags(opt));
+
+    if(max_length > codes->max_length || block.bits_position > codes->bits_position ||
+       length_fields * (codes->bits_length - block.bits_length) +
+       position_fields * (codes->bits_position - block.bits_position) > codes->bits_length + 12){
+	token = codes->widths | (uint64_t)max_length << codes->bits_length |
+		(uint64_t)block.bits_position << (codes->bits_length + 8);
+	if(bit_put(file_out, token, codes->bits_length + 12) == -1)
+	    return -1;
+	if(stats != NULL){
+	    stats->width_blocks++;
+	    stats->bits_code += codes->bits_length + 12;
+	}
+	*codes = block;
+    }
+
+    for(i = 0; i < n; i++){
+	switch(tokens[i].type){
+	case BLOCK_LITERALS:
+	    if(opt->literal_runs){
+		if(write_literals(file_out, w->window + tokens[i].value, tokens[i].length,
+				  codes->literals, codes->bits_length, stats) == -1)
+		    return -1;
+		break;
+	    }
+	    for(j = 0; j < tokens[i].length; j++)
+		if(bit_put(file_out, (uint64_t)w->window[tokens[i].value + j] << codes->bits_length,
+			   codes->bits_length + 8) == -1)
+		    return -1;
+	    if(stats != NULL){
+		stats->literals += tokens[i].length;
+		stats->literal_bytes += tokens[i].length;
+		stats->bits_length += tokens[i].length * codes->bits_length;
+		stats->bits_literal += 8 * tokens[i].length;
+	    }
+	    break;
+
+	default: // match, the forward code before the length
+	    token = tokens[i].length | (uint64_t)tokens[i].value << codes->bits_length;
+	    bits = codes->bits_length + codes->bits_position;
+	    if(tokens[i].type == BLOCK_FORWARD){
+		token = codes->forward | token << codes->bits_length;
+		bits += codes->bits_length;
+	    }
+	    if(bit_put(file_out, token, bits) == -1)
+		return -1;
+	    if(stats != NULL){
+		if(tokens[i].type == BLOCK_FORWARD){
+		    stats->forwards++;
+		    stats->bits_code += codes->bits_length;
+		}else{
+		    stats->matches++;
+		}
+		stats->match_bytes += tokens[i].length;
+		stats->bits_length += codes->bits_length;
+		stats->bits_position += codes->bits_position;
+		stats_match(stats, tokens[i].length, tokens[i].value + 1);
+	    }
+	}
+    }
+    return 0;
+}
+
+/**
+ * Check if the n bytes at w->data_position are worth a search: a hash table
+ * of the strings of KEY_BYTES bytes of the dictionary and of the block counts
+ * the strings of the block already seen. If they are less than one every
+ * STORED_MATCHES bytes the matches would pay at most a few bits, so the block
+ * is stored as it is. Already compressed data (JPEG, gzip, ...) has almost
+ * none of them.
+ *
+ * @return	1 if the block should be stored, 0 otherwise
+ */
+static int incompressible(const struct window *w, int n)
+{
+    uint16_t last[1 << STORED_HASH_BITS]; // last position + 1 of each string, 0 none
+    const unsigned char *s = w->window;
+    int end = w->data_position + n - KEY_BYTES;
+    int p, seen = 0;
+    uint32_t key, h;
+
+    if(n < STORED_MIN)
+	return 0;
+
+    memset(last, 0, sizeof(last));
+    for(p = w->dict_position; p <= end; p++){
+	key = string_key(s + p);
+	h = key * 2654435761u >> (32 - STORED_HASH_BITS);
+	if(p >= w->data_position && last[h] != 0 && string_key(s + last[h] - 1) == key &&
+	   ++seen > n / STORED_MATCHES)
+	    return 0;
+	last[h] = p + 1;
+    }
+    return 1;
+}
+
+/**
+ * Length of the run of bytes equal to the last encoded one (the byte before
+ * data_position) that starts at data_position, at most look_ah_length.
+ *
+ * @param w		window structure
+ * @param available	bytes still to encode
+ */
+static int run_length(const struct window *w, int available)
+{
+    const unsigned char *data = w->window + w->data_position;
+    unsigned char c = data[-1];
+    int max = w->look_ah_length;
+    int n = 0;
+
+    if(available < max)
+	max = available;
+    while(n < max && data[n] == c)
+	n++;
+    return n;
+}
+
+/**
+ * The strings between from and to (excluded) were inserted with bytes not yet
+ * read, insert them again so their keys and their place in the tree are
+ * updated. The tree compares look_ah_length bytes (see window_cmp()), so the
+ * last look_ah_length - 1 strings before the bytes read have this problem.
+ *
+ * @param tree	tree structure
+ * @param w	window structure
+ * @param from	first string
+ * @param to	first string not to update
+ */
+static void update_keys(struct tree *tree, const struct window *w, int from, int to)
+{
+    if(from < w->dict_position)
+	from = w->dict_position;
+    for(; from < to; from++){
+	delete_node(tree, from);
+	add_node(tree, from, w);
+    }
+}
+
+/**
+ * Insert in the tree the window_length strings of the dictionary.
+ * A string inside a run of a single byte is equal to the previous one so
+ * it's skipped: a run costs one insertion instead of one for each byte.
+ *
+ * @param tree	tree where insert the strings (it must be empty)
+ * @param w	window structure
+ */
+static void insert_dictionary(struct tree *tree, const struct window *w)
+{
+    const unsigned char *d = w->window + w->dict_position;
+    int length = w->look_ah_length;
+    int same = 0; // pairs of equal consecutive bytes ending at i+length-1
+    int i, j;
+
+    for(j = 1; j < length - 1 && j < w->window_length; j++)
+	same = (d[j] == d[j-1]) ? same + 1 : 0;
+
+    for(i = 0; i < w->window_length; i++){
+	j = i + length - 1;
+	if(j >= 1 && j < w->window_length)
+	    same = (d[j] == d[j-1]) ? same + 1 : 0;
+
+	// the bytes from i-1 to i+length-1 are all equal
+	if(i > 0 && j < w->window_length && same >= length){
+	    if(w->stats != NULL)
+		w->stats->insert_skips++;
+	    continue;
+	}
+	add_node(tree, w->dict_position + i, w);
+    }
+}
+
+
+/**
+ * Read n bytes from fd, less only at the end of the file.
+ *
+ * @return	the number of bytes read, -1 in case of error
+ */
+static int read_full(int fd, unsigned char *buf, int n)
+{
+    int done = 0;
+    ssize_t r;
+
+    while(done < n){
+	r = read(fd, buf + done, n - done);
+	if(r == 0)
+	    break;
+	if(r == -1){
+	    if(errno == EINTR)
+		continue;
+	    return -1;
+	}
+	done += r;
+    }
+    return done;
+}
+
+
+/**
+ * Return 1 if the preload can be used to compress with the options opt.
+ */
+static int preload_usable(const struct lz77_preload *pre, const struct options *opt)
+{
+    return pre != NULL && pre->dict == opt->dict && pre->window_len == opt->window_len &&
+	   pre->look_ahead_len == opt->look_ahead_len && pre->max_depth == opt->max_depth;
+}
+
+
+struct lz77_preload *encode_preload(struct options opt)
+{
+    struct lz77_preload *pre;
+    struct window win;
+
+    pre = calloc(1, sizeof(struct lz77_preload));
+    if(pre == NULL)
+	return NULL;
+    pre->dict = opt.dict;
+    pre->window_len = opt.window_len;
+    pre->look_ahead_len = opt.look_ahead_len;
+    pre->max_depth = opt.max_depth;
+    pre->ctx = lz77_context_create(COMPRESSION, opt.window_len);
+    if(pre->ctx == NULL){
+	free(pre);
+	return NULL;
+    }
+
+    // the same window that encode_context() uses before reading the input
+    bzero(&win, sizeof(struct window));
+    win.look_ah_length = opt.look_ahead_len;
+    win.window_length = opt.window_len;
+    win.max_depth = opt.max_depth;
+    win.dict_position = 0;
+    win.data_position = win.window_length;
+    win.window = pre->ctx->window;
+
+    if(load_dictionary(&win, opt.dict) == -1){
+	lz77_preload_free(pre);
+	return NULL;
+    }
+    insert_dictionary(&pre->ctx->tree, &win);
+
+    return pre;
+}
 
 
 int encode(struct options opt)
+{
+    struct lz77_context *ctx;
+    int ret;
+
+    ctx = lz77_context_create(COMPRESSION, opt.window_len);
+    if(ctx == NULL)
+	return -1;
+    ret = encode_context(ctx, opt);
+    lz77_context_free(ctx);
+    return ret;
+}
+
+
+/**
+ * Read function of the input of encode_context(), arg points to the file descriptor.
+ */
+static int read_fd(void *arg, unsigned char *buf, int n)
+{
+    return read_full(*(int*)arg, buf, n);
+}
+
+
+int encode_context(struct lz77_context *ctx, struct options opt)
+{
+    struct lz77_input in;
+    struct bitfile *file_out;
+    struct lz77_stats stats;
+    struct lz77_stats *p_stats = NULL;
+    struct pipeline *pipe = NULL;
+    int fd_input;
+    int fd_output = -1;
+    int write_error;
+    int ret;
+
+    print_options(opt);
+
+    if(opt.verbose || opt.stats_file != NULL){
+	bzero(&stats, sizeof(stats));
+	p_stats = &stats;
+    }
+
+    if(opt.file_in == NULL){
+	fd_input = STDIN_FILENO;
+    }else{
+    	 fd_input = open(opt.file_in, O_RDONLY);
+   	 if (fd_input == -1)
+		return -1;
+    }
+
+    if(opt.file_out == NULL){
+	fd_output = opt.stdout_fd;
+    }else{
+	fd_output = open(opt.file_out, O_WRONLY|O_CREAT|(opt.exclusive ? O_EXCL : O_TRUNC), S_IRWXU);
+	if(fd_output == -1){
+	    if(opt.file_in != NULL)
+		close(fd_input);
+	    return -1;
+	}
+    }
+
+    if(opt.pipeline){
+	// the reader and the writer threads do the I/O of the files
+	pipe = pipeline_start(fd_input, fd_output, opt.io_uring ? PIPELINE_URING : 0);
+	if(pipe == NULL){
+	    ret = -1;
+	    goto end;
+	}
+	file_out = bit_open_io_at(pipeline_bit_write, pipe, BIT_WR, CONTEXT_BUFSIZE, ctx->bitfile);
+	in.read = pipeline_read;
+	in.arg = pipe;
+    }else{
+	file_out = bit_fdopen_at(fd_output,BIT_WR,CONTEXT_BUFSIZE,ctx->bitfile);
+	in.read = read_fd;
+	in.arg = &fd_input;
+    }
+
+    ret = encode_stream(ctx, opt, &in, file_out, p_stats);
+
+    // the errors of the last writes are known only here
+    write_error = bit_close(file_out) == -1;
+    if(pipe != NULL && pipeline_finish(pipe) == -1)
+	write_error = 1;
+    if(write_error && ret != -1){
+	printf("ERROR!!! %s can't be written: %s\n",
+	       opt.file_out != NULL ? opt.file_out : "the standard output", strerror(errno));
+	ret = -1;
+    }
+
+end:
+    // close files
+    if(opt.file_out != NULL)
+	close(fd_output);
+    if(opt.file_in != NULL)
+	    close(fd_input);
+
+    if(ret == -1){
+	if(opt.file_out != NULL)
+	    remove(opt.file_out);
+	return ret;
+    }
+
+    if(p_stats != NULL && stats_report(&stats, 1, opt.verbose, opt.stats_file) == -1)
+	return -1;
+
+    return 0;
+}
+
+
+int encode_stream(struct lz77_context *ctx, struct options opt, struct lz77_input *in,
+		  struct bitfile *file_out, struct lz77_stats *stats)
 {
 
     struct window win;
-    struct Node *tree = NULL;
+    struct tree *tree = NULL;
     struct match match;
-    FILE *file_input = NULL;
-    struct bitfile *file_out = NULL;
-    struct header *header = NULL;
+    struct header header;
     int bytes_2_encode = 0; // how many bytes I've to encode
     int i; 
     int ret = 0;
     int flag_EOF = 0; // 0 not EOF 1 I've met the EOF
-    int forward_code; 
     int quanti; 
-    int bits_length;
-    int bits_position;
+    struct token_codes codes;
+    struct block_token tokens[WIDTH_BLOCK_TOKENS]; // tokens waiting for the widths of their block (block_widths)
+    int n_tokens = 0;
     int break_event; // used to choose which code is convenient
-    int eof_code;
+    int run_break_event; // the same with literals waiting for a match
+    unsigned char literals[BYTES_MAX_LITERALS]; // literals not yet written (fast_decode, literal_runs)
+    int n_literals = 0;
+    int chunk;
     int from_where;
+    int run; // the match is a run of a single byte
+    int run_total = 0; // bytes of the current run already encoded
+    uint32_t block_crc;
+    uint32_t content_crc = 0;
+    uint64_t t, t_block; // start of the trace spans
+    const struct lz77_preload *preload;
+
+    if(ctx->mode != COMPRESSION || ctx->window_len != opt.window_len){
+	errno = EINVAL;
+	return -1;
+    }
+    lz77_context_reset(ctx);
+
+    // the byte aligned format has its own runs of literals and widths
+    if(opt.fast_decode){
+	opt.literal_runs = 0;
+	opt.block_widths = 0;
+    }
 
     // Initialize part of the window structure
     bzero(&win, sizeof(struct window));
+    win.stats = stats;
     win.look_ah_length = opt.look_ahead_len;
     win.window_length = opt.window_len;
+    win.max_visits = opt.max_visits;
+    win.nice_length = opt.nice_len;
+    win.max_depth = opt.max_depth;
     win.dict_position = 0;
     win.data_position = win.window_length;
-    win.window = calloc(win.window_length*2, sizeof(char) );
-    if(win.window == NULL)
-	return -1;
+    win.window = ctx->window;
+    tree = &ctx->tree;
 
-    /* eof code = look_ahead_len + 1
-       forward_code = look_ahead_len +2	
-     */
-    forward_code = win.look_ah_length +2;
-    eof_code = win.look_ah_length + 1;
-
-  
-    bits_length = number_of_bits(win.look_ah_length + 2);
-    bits_position = number_of_bits(win.window_length);	
+    // the codes of the whole file, or of the first block of tokens
+    set_token_codes(&codes, win.look_ah_length, number_of_bits(win.window_length), stream_flags(&opt));
 
     // is used to know if it's conveniente use no match case instead of a match
-    break_event = (bits_length+bits_position)/(bits_length+8);
+    break_event = (codes.bits_length+codes.bits_position)/(codes.bits_length+8);
+    // while a run of literals is open a literal costs only its 8 bits
+    run_break_event = opt.literal_runs ? (codes.bits_length+codes.bits_position)/8 : break_event;
 
-    print_options(opt);
+    // the counters of the insertions need the real load
+    preload = win.stats == NULL && preload_usable(ctx->preload, &opt) ? ctx->preload : NULL;
 
-    ret = load_dictionary(&win,opt.dict);
-    if(ret == -1){
-	free(win.window);
-	return -1;
-    }    
-
-    tree = build_tree( win.window_length );
-    if( tree == NULL){
-	free(win.window);
-	return -1;
-    }
-
-    if(opt.file_in == NULL){
-	file_input = stdin;
+    t = trace_begin();
+    if(preload != NULL){
+	memcpy(win.window, preload->ctx->window, win.window_length);
+	ret = 0;
     }else{
-    	 file_input = fopen(opt.file_in,"r");
-
-   	 if (file_input == NULL) {
-		free(tree);
-		free(win.window);
-		return -1;
-    	 }
-    }
-
-    file_out = bit_open(opt.file_out,BIT_WR,128);
-    if(file_out == NULL){
-	if(file_input != stdin )
-        	fclose(file_input);
-       	free(win.window);
-        free(tree);
-        return -1;
+	ret = load_dictionary(&win,opt.dict);
     }
+    trace_end("load dictionary", t);
+    if(ret == -1)
+	return -1;
 
     // write the header
-    header = build_header(&opt);
+    init_header(&header, &opt);
 
-    ret = write_header(file_out, header);
-    free(header);
+    ret = write_header(file_out, &header);
+    if(ret == -1)
+	return -1;
+    if(stats != NULL)
+	stats->bits_header += header.header_len * 8;
 
     // insert the dictionary in the tree
-    for(i = 0; i < win.window_length ; i++)
-	add_node(tree,win.dict_position+i,&win); 	
+    t = trace_begin();
+    if(preload != NULL){
+	memcpy(tree->nodes, preload->ctx->tree.nodes, (tree->n_nodes + 1) * sizeof(struct Node));
+	memcpy(tree->father, preload->ctx->tree.father, (tree->n_nodes + 1) * sizeof(uint16_t));
+    }else{
+	insert_dictionary(tree, &win);
+    }
+    trace_end("build tree", t);
 
     // I've just window_length dictionary data, fill the others with data that will be encoded
     quanti = win.window_length*2 - win.window_length;	
@@ -112,69 +716,241 @@ int encode(struct options opt)
     for(;;){
 
         // read necessary bytes to fill the buffer from file_input or less (EOF)
-        bytes_2_encode += fread(win.window + from_where , 1, quanti , file_input);
+	t = trace_begin();
+        ret = in->read(in->arg, win.window + from_where, quanti);
+	trace_end("read", t);
+        if (ret == -1){
+            // the file_output isn't complete, it's removed below
+            break;
+        }
+	bytes_2_encode += ret;
+	update_keys(tree, &win, from_where - (win.look_ah_length - 1), win.data_position < from_where ? win.data_position : from_where);
 	
-        if ( feof(file_input) ){
+        if ( ret < quanti ){
 	    //printf("EOF\n");
             flag_EOF = 1;
+	    // the matches can't go beyond the last byte
+	    if( bytes_2_encode < win.look_ah_length )
+		win.look_ah_length = bytes_2_encode;
+	}
+
+	t_block = trace_begin();
+
+	// a block of incompressible data is stored as it is, the search would
+	// cost much more and find only matches that don't pay their bits
+	if((opt.literal_runs || opt.fast_decode) && incompressible(&win, bytes_2_encode)){
+	    t = trace_begin();
+	    if(opt.fast_decode){ // literals, the sequences have no limit on them
+		for(i = 0; ret != -1 && i < bytes_2_encode; i += chunk){
+		    chunk = BYTES_MAX_LITERALS - n_literals;
+		    if(chunk > bytes_2_encode - i)
+			chunk = bytes_2_encode - i;
+		    memcpy(literals + n_literals, win.window + win.data_position + i, chunk);
+		    n_literals += chunk;
+		    if(n_literals == BYTES_MAX_LITERALS){
+			ret = write_sequence(file_out, literals, n_literals, BYTES_CONTROL, BYTES_LITERALS, stats);
+			n_literals = 0;
+		    }
+		}
+		if(stats != NULL){
+		    stats->literals += bytes_2_encode;
+		    stats->literal_bytes += bytes_2_encode;
+		    stats->bits_literal += 8 * bytes_2_encode;
+		}
+	    }else{
+		if(n_tokens > 0)
+		    ret = write_token_block(file_out, &win, tokens, n_tokens, &codes, &opt, stats);
+		n_tokens = 0;
+		if(n_literals > 0 && ret != -1)
+		    ret = write_literals(file_out, literals, n_literals, codes.literals, codes.bits_length, stats);
+		n_literals = 0;
+		if(ret != -1)
+		    ret = write_stored(file_out, win.window + win.data_position, bytes_2_encode,
+				       codes.literals, codes.bits_length, stats);
+	    }
+	    trace_add(TRACE_EMIT, t);
+	    if(ret == -1)
+		break;
+
+	    // the strings of the block aren't inserted in the tree
+	    t = trace_begin();
+	    for(i = 0; i < bytes_2_encode; i++)
+		delete_node(tree, win.dict_position + i);
+	    if(stats != NULL){
+		stats->deletes += bytes_2_encode;
+		stats->insert_skips += bytes_2_encode;
+	    }
+	    trace_add(TRACE_TREE, t);
+
+	    win.dict_position += bytes_2_encode;
+	    win.data_position += bytes_2_encode;
+	    bytes_2_encode = 0;
+	    run_total = 0;
 	}
-     
-        if (ferror(file_input) ){
-            // remove the file_output isn't complete
-            remove(opt.file_out);
-            break;
-        }
 
         while(bytes_2_encode > 0){
 
             // find a match
-            match = find_match(tree, win);
+	    t = trace_begin();
+	    // a run of a single byte as long as the look ahead is sent as a
+	    // forward match at offset 1, without searching the tree
+	    run = win.look_ah_length >= RUN_MIN && run_length(&win, bytes_2_encode) == win.look_ah_length;
+	    if(run){
+		match.len = win.look_ah_length;
+		match.position = win.data_position - 1;
+		// when the whole dictionary is the run a normal match (wrap mode)
+		// at the same position gives the same bytes without the forward code
+		match.type = run_total < win.window_length;
+		run_total += match.len;
+		if(stats != NULL)
+		    stats->runs++;
+	    }else{
+		match = find_match(tree, win);
+		run_total = 0;
+	    }
+	    trace_add(TRACE_MATCH, t);
 
 	    // is it convenient ?
-	    if((break_event == match.len) && !match.type )
+	    if(opt.fast_decode){
+		if(match.len < BYTES_MIN_MATCH)
+		    match.len = 0;
+	    }else if((match.len <= (literals_open(n_literals, tokens, n_tokens) ? run_break_event : break_event)) && !match.type )
 		match.len = 0;	    
 
 	    // write in the file output
-	    if((match.len == 0) ){ // no match
-		// write 0	
-		ret = bit_write(file_out,(char*)(&match.len),bits_length ,0);
+	    t = trace_begin();
+	    if(opt.fast_decode){ // a sequence for each match, it takes the literals before it
+		if(match.len == 0){
+		    literals[n_literals++] = win.window[win.data_position];
+		    match.len = 1;
+		    ret = 0;
+		    if(n_literals == BYTES_MAX_LITERALS){
+			ret = write_sequence(file_out, literals, n_literals, BYTES_CONTROL, BYTES_LITERALS, stats);
+			n_literals = 0;
+		    }
+		    if(stats != NULL){
+			stats->literals++;
+			stats->literal_bytes++;
+			stats->bits_literal += 8;
+		    }
+		}else{
+		    ret = write_sequence(file_out, literals, n_literals,
+					 (match.position - win.dict_position) | match.type << 15, match.len, stats);
+		    n_literals = 0;
+		    if(stats != NULL){
+			if(match.type)
+			    stats->forwards++;
+			else
+			    stats->matches++;
+			stats->match_bytes += match.len;
+			stats_match(stats, match.len, win.data_position - match.position);
+		    }
+		}
 		if(ret == -1)
 			break;
 
-		// write the char
-		ret = bit_write(file_out,(char*)(&win.window[win.data_position]), 8, 0);
+	    }else if(opt.block_widths){ // the tokens wait for the widths of their block
+		if(match.len == 0){
+		    // the literals of a run are contiguous in the window
+		    if(literals_open(0, tokens, n_tokens) && tokens[n_tokens - 1].length < opt.look_ahead_len)
+			tokens[n_tokens - 1].length++;
+		    else
+			tokens[n_tokens++] = (struct block_token){ BLOCK_LITERALS, 1, win.data_position };
+		    match.len = 1;
+		}else{
+		    tokens[n_tokens++] = (struct block_token){ match.type ? BLOCK_FORWARD : BLOCK_MATCH, match.len,
+							       win.data_position - 1 - match.position };
+		}
+		ret = 0;
+		if(n_tokens == WIDTH_BLOCK_TOKENS){
+		    ret = write_token_block(file_out, &win, tokens, n_tokens, &codes, &opt, stats);
+		    n_tokens = 0;
+		    if(ret == -1)
+			break;
+		}
+
+	    }else if(opt.literal_runs && match.len == 0){ // the literals wait for the next match
+		literals[n_literals++] = win.window[win.data_position];
+		match.len = 1;
+		ret = 0;
+		if(n_literals == opt.look_ahead_len){
+		    ret = write_literals(file_out, literals, n_literals, codes.literals, codes.bits_length, stats);
+		    n_literals = 0;
+		    if(ret == -1)
+			break;
+		}
+
+	    }else if((match.len == 0) ){ // no match
+		// 0 and the char
+		ret = bit_put(file_out, (uint64_t)win.window[win.data_position] << codes.bits_length,
+			      codes.bits_length + 8);
 		if(ret == -1)
 			break;
 
 		match.len = 1;
 
+		if(stats != NULL){
+		    stats->literals++;
+		    stats->literal_bytes++;
+		    stats->bits_length += codes.bits_length;
+		    stats->bits_literal += 8;
+		}
+
 	    }else{ // match
+		if(n_literals > 0){
+		    ret = write_literals(file_out, literals, n_literals, codes.literals, codes.bits_length, stats);
+		    n_literals = 0;
+		    if(ret == -1)
+			break;
+		}
+
 		// we must consider the offset
-		int position = match.position - win.dict_position;
-	
+		uint64_t position = match.position - win.dict_position;
+		uint64_t token = match.len | position << codes.bits_length;
+		int bits_token = codes.bits_length + codes.bits_position;
+
+		// the fields of the token in a single write, the first in the
+		// least significant bits
 		if(match.type){
-			ret = bit_write(file_out,(char*)(&forward_code),bits_length,0);		
-			if(ret == -1)
-				break;			
+			token = codes.forward | token << codes.bits_length;
+			bits_token += codes.bits_length;
 		}
-		
-		//ret = bit_write(file_out,(char*)(&match.len),bits_length,0);
-		ret = bit_write(file_out,(char*)(&match.len),bits_length,0);
-		if(ret == -1)
-			break;	
-
-		ret = bit_write(file_out,(char*)(&position), bits_position, 0);
+		ret = bit_put(file_out, token, bits_token);
 		if(ret == -1)
 			break;			
 
+		if(stats != NULL){
+		    if(match.type){
+			stats->forwards++;
+			stats->bits_code += codes.bits_length;
+		    }else{
+			stats->matches++;
+		    }
+		    stats->match_bytes += match.len;
+		    stats->bits_length += codes.bits_length;
+		    stats->bits_position += codes.bits_position;
+		    stats_match(stats, match.len, win.data_position - match.position);
+		}
 	    }
 	
+	    trace_add(TRACE_EMIT, t);
+	
 	    // update the tree
+	    t = trace_begin();
+	    if(stats != NULL)
+		stats->deletes += match.len;
 	    for(i = 0; i < match.len; i++ ){
-		delete_node(tree, win.dict_position,win.window_length);
+		delete_node(tree, win.dict_position);
 		win.dict_position++;
+		// only the first string of a run goes in the tree, the others are equal
+		if(run && i > 0){
+		    if(stats != NULL)
+			stats->insert_skips++;
+		    continue;
+		}
 		add_node(tree,win.data_position+i,&win);
 	    }
+	    trace_add(TRACE_TREE, t);
 
 	    win.data_position += match.len;
 	    bytes_2_encode-=match.len;	
@@ -189,53 +965,83 @@ int encode(struct options opt)
 	    }
 
         }//end while(bytes_2_encode)
+	trace_block("encode block", t_block);
 
 	if(ret == -1) // some error in encode loop
 		break;
-	
+
+	// the tokens refer to the window, they go before it's moved
+	if(n_tokens > 0){
+	    ret = write_token_block(file_out, &win, tokens, n_tokens, &codes, &opt, stats);
+	    n_tokens = 0;
+	    if(ret == -1)
+		break;
+	}
+
+	// the literals waiting for a match go before the block or eof code
+	if(opt.literal_runs && n_literals > 0 && (opt.checksum || flag_EOF)){
+	    ret = write_literals(file_out, literals, n_literals, codes.literals, codes.bits_length, stats);
+	    n_literals = 0;
+	    if(ret == -1)
+		break;
+	}
+
+	// close the block with the checksum of the data encoded in this cycle
+	// (from window_length to data_position)
+	if(opt.checksum){
+	    block_crc = crc32c(0, win.window + win.window_length, win.data_position - win.window_length);
+	    content_crc = crc32c(content_crc, win.window + win.window_length, win.data_position - win.window_length);
+	    if(opt.fast_decode){
+		ret = write_sequence(file_out, literals, n_literals, BYTES_CONTROL, BYTES_BLOCK, stats);
+		n_literals = 0;
+		if(ret != -1)
+		    ret = write_checksum(file_out, -1, 0, block_crc);
+	    }else{
+		ret = write_checksum(file_out, codes.block, codes.bits_length, block_crc);
+		if(stats != NULL)
+		    stats->bits_code += codes.bits_length;
+	    }
+	    if(ret == -1)
+		break;
+	    if(stats != NULL){
+		stats->blocks++;
+		stats->bits_checksum += 32;
+	    }
+	}
 
         if(flag_EOF == 1){
             // write the special code to eof
-	    ret = bit_write(file_out,(char*)(&eof_code),bits_length,0);
+	    if(opt.fast_decode){
+		ret = write_sequence(file_out, literals, n_literals, BYTES_CONTROL, BYTES_EOF, stats);
+	    }else{
+		ret = bit_write(file_out,(char*)(&codes.eof),codes.bits_length,0);
+		if(stats != NULL)
+		    stats->bits_code += codes.bits_length;
+	    }
+	    if(ret != -1 && opt.checksum)
+		ret = write_checksum(file_out, -1, 0, content_crc);
+	    if(stats != NULL)
+		stats->bits_checksum += opt.checksum ? 32 : 0;
             break;
         }
 
         // I must reload the window so I've to copy the dictionary (and data if there are some) at the beggining
 	// memmove is necessary because the memory areas can be overlap 
+	t = trace_begin();
 	memmove( win.window, win.window + win.dict_position , (win.window_length + bytes_2_encode) );
+	trace_end("memmove", t);
+
+	// the strings in the tree are moved too, so the tree is still good
+	move_tree(tree, win.dict_position);
 
         win.dict_position = 0;
 	win.data_position = win.window_length;
         from_where = win.data_position + bytes_2_encode;
         quanti = win.window_length*K - (win.window_length + bytes_2_encode);
 
-
-	// clear all informations about nodes
-	empty_tree(tree, win.window_length);
-
-
-	// add the dictionary in the tree
-    	for(i = 0; i < win.window_length ; i++)
-		add_node(tree,win.dict_position+i,&win);
-
     }// end for(;;)
 
-    // free memory
-    free(tree);
-    free(win.window);
-
-    // close files
-    bit_close(file_out);
-    if(opt.file_in != NULL)
-	    fclose(file_input);
-
-    if(ret == -1){
-	remove(opt.file_out);
-	return ret;
-    }
-
-
-    return 0;
+    return ret == -1 ? -1 : 0;
 }
 
 
@@ -248,59 +1054,94 @@ int encode(struct options opt)
  *
  * @return		: the length of the match
  */
-struct match find_match(struct Node *tree, struct window w)
+struct match find_match(struct tree *tree, struct window w)
 {
    	struct match match;
+	struct Node *nodes = tree->nodes;
+	const unsigned char *data = w.window + w.data_position;
 	int i;
 	int node;
+	int dict_node;
 	int string_head;
 	int diff;
 	int count;
 	int type;
+	int max;
+	int visits = 0;
+	int nice_length;
+	uint32_t key, x;
+
+	// a nice length greater than the look ahead can't be reached
+	nice_length = w.look_ah_length;
+	if(w.nice_length > 0 && w.nice_length < nice_length)
+		nice_length = w.nice_length;
 
-	node = tree[ROOT].greater;
-	string_head = tree[node].position;
 	match.len = 0;
 	match.position = 0;
 	match.type = 0;
 
-	// the search is stopped if the match is the longest as possible or we're in a leaf
-	for(;;){
+	// all the strings can be out of the tree (runs, max depth)
+	if(nodes[ROOT].greater == UNUSED)
+		return match;
 
-		diff = w.window[ string_head ] - w.window[ w.data_position ];
+	// the match can't go out of the window array
+	max = w.look_ah_length;
+	if(w.data_position + max > w.window_length*K)
+		max = w.window_length*K - w.data_position;
 
-		count = 0;
-		i = 0;
-		type = 0;
+	key = string_key(data);
+	dict_node = node_index(tree, w.dict_position);
+	node = nodes[ROOT].greater;
+
+	// the search is stopped if the match is the longest as possible or we're in a leaf
+	for(;;){
 
-       		// stay in this node and check for a longest match
-		while(  (diff == 0) && (count != w.look_ah_length) && (w.data_position + i < w.window_length*K) ){
-			count++;
-			i++;
-			diff = w.window[ wrap(string_head + i, w.window_length + w.dict_position , w.dict_position)] - w.window[ w.data_position + i ];
+		visits++;
+
+		// load both sons while this node is compared, the next one is
+		// one of them
+		prefetch(&nodes[ nodes[node].smaller ]);
+		prefetch(&nodes[ nodes[node].greater ]);
+
+		string_head = node_position(tree, node, w.dict_position, dict_node);
+
+		// the first bytes are compared with the key, the window is read
+		// only if they're all equal
+		x = nodes[node].key ^ key;
+		if(x != 0){
+			count = __builtin_clz(x) / 8;
+			diff = nodes[node].key < key ? -1 : 1;
+		}else{
+			// the sons are likely to have the same key, so they will
+			// read the window too
+			prefetch(w.window + node_position(tree, nodes[node].smaller, w.dict_position, dict_node) + KEY_BYTES);
+			prefetch(w.window + node_position(tree, nodes[node].greater, w.dict_position, dict_node) + KEY_BYTES);
+			count = KEY_BYTES;
+			diff = 0;
+			while( count < max && (diff = w.window[string_head + count] - data[count]) == 0 )
+				count++;
 		}
+		if(count > max)
+			count = max;
 
-		// to search a match looking in the look ahead we've 2 condictions .
-		// 1 - the string_head must be in the "Forward Zone"
-		// 2 - the match found in wrap mode must be equal or greater to the distance between string head and data_position
-		if( (string_head > (w.data_position - w.look_ah_length) ) && (count >= ( w.data_position - string_head) ) ){
-			int count_forward;
+		type = 0;
 
-			// I know that the first border - string_head chars are good
-			count_forward = w.data_position - string_head;
-			diff = w.window[string_head + count_forward] - w.window[ w.data_position + count_forward];
+		// the strings in the last look_ah_length bytes of the dictionary can
+		// match in two ways, a forward match (the string go on in the look
+		// ahead) or a match in wrap mode (the string go on from the begin of
+		// the dictionary, see wrap())
+		i = w.data_position - string_head;
+		if( i < w.look_ah_length && count >= i ){
+			int count_wrap = i;
 
-			while( (diff == 0) && (count_forward != w.look_ah_length) && (w.data_position + count_forward < w.window_length*K) ){
-				count_forward++;
-				diff = w.window[string_head + count_forward ] - w.window[ w.data_position + count_forward ];
-			}
+			while( count_wrap < max && w.window[w.dict_position + count_wrap - i] == data[count_wrap] )
+				count_wrap++;
 
 			// equal isn't good because we send 2*L+W against L+W
-			if(count_forward > count){
-				count = count_forward;
+			if( count > count_wrap )
 				type = 1;
-			}
-
+			else
+				count = count_wrap;
 		}
 
         	// if this match (count) is longest than the previous then save it
@@ -312,18 +1153,28 @@ struct match find_match(struct Node *tree, struct window w)
 
 		// maybe we can have a longest match if we check on right son
 		if(diff < 0)
-			node = tree[node].greater;
+			node = nodes[node].greater;
 		else
-			node = tree[node].smaller;
-		
+			node = nodes[node].smaller;
+
 	        // if we've see all possible strings or found the longest match possible then exit from while
 	        if (( node == UNUSED ) || ( match.len == w.look_ah_length ) )
 			break;
 
-        	string_head = tree[node].position;	
+		// the match is good enough or we've already spent too much time
+		if (( match.len >= nice_length ) || ( w.max_visits > 0 && visits >= w.max_visits )){
+			if(w.stats != NULL)
+				w.stats->search_cutoffs++;
+			break;
+		}
+	}
 
+	if(w.stats != NULL){
+		w.stats->searches++;
+		w.stats->search_visits += visits;
+		if((uint64_t)visits > w.stats->search_max_visits)
+			w.stats->search_max_visits = visits;
 	}
 
 	return match;
 }
-
@@ -1,4 +1,42 @@
 #include "../include/option.h"
+#include "../include/archive.h"
+#include <getopt.h>
+
+// value returned by getopt_long() for the options without a short name
+#define OPT_TRACE 1000
+#define OPT_MAX_VISITS 1001
+#define OPT_NICE_LENGTH 1002
+#define OPT_MAX_DEPTH 1003
+#define OPT_BATCH 1004
+#define OPT_JOBS 1005
+#define OPT_SOLID 1006
+#define OPT_RESTART 1007
+#define OPT_EXTRACT 1008
+#define OPT_NO_PIPELINE 1009
+#define OPT_IO_URING 1010
+#define OPT_FAST_DECODE 1011
+#define OPT_NO_LITERAL_RUNS 1012
+#define OPT_FIXED_WIDTHS 1013
+#define OPT_AUTO 1014
+
+static const struct option long_options[] = {
+	{ "trace", required_argument, NULL, OPT_TRACE },
+	{ "max-visits", required_argument, NULL, OPT_MAX_VISITS },
+	{ "nice-length", required_argument, NULL, OPT_NICE_LENGTH },
+	{ "max-depth", required_argument, NULL, OPT_MAX_DEPTH },
+	{ "batch", no_argument, NULL, OPT_BATCH },
+	{ "jobs", required_argument, NULL, OPT_JOBS },
+	{ "solid", no_argument, NULL, OPT_SOLID },
+	{ "restart", required_argument, NULL, OPT_RESTART },
+	{ "extract", required_argument, NULL, OPT_EXTRACT },
+	{ "no-pipeline", no_argument, NULL, OPT_NO_PIPELINE },
+	{ "io-uring", no_argument, NULL, OPT_IO_URING },
+	{ "fast-decode", no_argument, NULL, OPT_FAST_DECODE },
+	{ "no-literal-runs", no_argument, NULL, OPT_NO_LITERAL_RUNS },
+	{ "fixed-widths", no_argument, NULL, OPT_FIXED_WIDTHS },
+	{ "auto", required_argument, NULL, OPT_AUTO },
+	{ NULL, 0, NULL, 0 }
+};
 
 
 
@@ -11,21 +49,45 @@ void usage()
 	printf("options \n");
 	printf("  -c\tSet compression mode\n");
 	printf("  -d\tSet decompression mode\n");
-	printf("  -i FILE\n\tFilename input (source).\n\tIn compression mode if is omitted the software use the standard input,\n\tinstead in decompression mode you must specify it.\n");
-	printf("  -o FILE\n\tFile name output (destination).\n\tIn decompression mode if is omitted the software use the standard output,\n\tinstead in compression mode you must specify it.\n");
-	printf("  -t DICTIONARY\n\tSpecify which dictionary you want to use\n\tThe default one is 'it'. The name must be of 2 characters.\n");
+	printf("  -T\tSet test mode, the file is decompressed and checked without writing the output\n");
+	printf("  -s\tAdd a checksum (CRC32C) for each block and for the whole content,\n\tthey are checked in decompression and test mode.\n");
+	printf("  --fast-decode\n\tWrite the tokens as byte aligned sequences instead of bit fields: the file is\n\tbigger but it's decompressed faster, for data decompressed much more often than compressed\n");
+	printf("  --no-literal-runs\n\tA token for each literal instead of a token for a run of literals\n");
+	printf("  --fixed-widths\n\tThe same length and position fields for the whole file instead of the\n\tnarrowest ones for each block of tokens. With --no-literal-runs the file\n\tcan be decompressed by the older versions of the software\n");
+	printf("  -i FILE\n\tFilename input (source).\n\tIf is omitted the software use the standard input (not for a solid archive).\n");
+	printf("  -o FILE\n\tFile name output (destination).\n\tIf is omitted the software use the standard output (not for a solid archive)\n\tand the messages go to the standard error.\n");
+	printf("  -t DICTIONARY\n\tSpecify which dictionary you want to use\n\tThe available ones are 'it', 'en' and 'cc', the default one is 'it'.\n");
 	printf("  -l VALUE\n\tSet look-ahead length, must specify a positive value.\n\tMin value is 8 and the max value is 255\n");
 	printf("  -w VALUE\n\tSet window length, must specify a positive value.\n\tMin value must be equal to look ahead length the max value is 32767.\n");
-	printf("  -v\tSet verbose mode\n");
+	printf("  --auto SPEED\n\tChoose window length, look ahead length, dictionary and search limits\n\tcompressing a few slices of the input (a file) with each candidate: the best\n\tratio among the ones compressing at least SPEED MB/s (0 means only the ratio)\n");
+	printf("  -v\tSet verbose mode, the statistics of the run are printed in JSON format on the standard error\n");
+	printf("  -S FILE\n\tWrite the statistics of the run in JSON format in FILE\n");
+	printf("  --trace FILE\n\tWrite the time spent in each phase (dictionary load, tree build, reads, ...)\n\tin FILE, the format is the Chrome trace-event JSON\n");
+	printf("  --max-visits VALUE\n\tStop a match search after VALUE nodes of the tree (0, the default, means no limit)\n");
+	printf("  --nice-length VALUE\n\tStop a match search as soon as it finds a match of VALUE bytes\n\t(0, the default, means the look ahead length)\n");
+	printf("  --max-depth VALUE\n\tDon't insert in the tree the strings that would be deeper than VALUE\n\t(0, the default, means no limit)\n");
+	printf("  The last three options trade compression ratio for speed, they are used only in compression mode.\n");
+	printf("  --batch\n\tCompress (or decompress, test) all the files given after the options, or one for\n\teach line of the standard input if there aren't, in a single process.\n\tThe output of FILE is FILE.lz77, in decompression FILE.lz77 gives FILE.\n\tThe existing outputs aren't overwritten. -i and -o can't be used.\n");
+	printf("  --jobs VALUE\n\tNumber of threads of the batch mode, the default is one for each CPU\n");
+	printf("  --solid\n\tCompress all the files given after the options (or on the standard input like\n\t--batch) in the archive -o through a single window, so a file can use the\n\tfiles before it. With -d the files of the archive -i are extracted, with -T\n\tthe archive is checked (and listed with -v).\n");
+	printf("  --restart VALUE\n\tBytes between the restart points of a solid archive, a file is extracted\n\tdecompressing from the nearest one before it. 0 means only one at the\n\tstart, the default is %d\n", ARCHIVE_RESTART);
+	printf("  --extract NAME\n\tExtract only the file NAME of a solid archive in -o (or the standard output)\n");
+	printf("  --no-pipeline\n\tRead and write the files in the same thread of the compression, by default\n\ta reader and a writer thread do the I/O while the data is compressed\n");
+	printf("  --io-uring\n\tThe reader and the writer threads keep many reads and writes in flight with\n\tio_uring (Linux), on the regular files. Where it isn't available they use read()/write()\n");
 	printf("\nEXAMPLES\n");
 	printf("  Using files  ./lz77 -c -o compress_file  -i original_file -w 1024 -l 16 -t it\n");
 	printf("  Using STDIN  ./lz77 -c -o compress_file -w 1024 -l 16 -t it\n");
 	printf("  Using STDOUT ./lz77 -i compress_file -w 1024 -l 16 -t it\n");
+	printf("  Filter       producer | ./lz77 -c | ssh host './lz77 -d > file'\n");
+	printf("  Auto         ./lz77 -c --auto 5 -v -i original_file -o compress_file\n");
+	printf("  Batch        find dir -type f | ./lz77 -c --batch --jobs 4\n");
+	printf("  Solid        ./lz77 -c --solid -o archive file1 file2 file3\n");
+	printf("               ./lz77 -d --solid -i archive --extract file2 -o file2.copy\n");
 	printf("\nNOTE\n");
 	printf("  If you're using the STDIN typing the text manually use Ctrl+D to do EOF.\n");
 	printf("\nDEFAULT VALUES\n");
-	printf("  Window length : 2048 bytes\n");
-	printf("  Look ahead length : 64 bytes\n");
+	printf("  Window length : %d bytes\n", DEFAULT_WINDOW_LEN);
+	printf("  Look ahead length : %d bytes\n", DEFAULT_LOOK_AHEAD_LEN);
 	printf("  Dictionary : it\n\n");
 	exit(0);
 
@@ -41,15 +103,35 @@ int init_opt(struct options *opt)
 	}
 
 	opt->mode = NONE;
-	opt->window_len = 1024;
-	opt->look_ahead_len = 64;
+	opt->window_len = DEFAULT_WINDOW_LEN;
+	opt->look_ahead_len = DEFAULT_LOOK_AHEAD_LEN;
 	opt->verbose = 0;
+	opt->checksum = 0;
+	opt->stats_file = NULL;
+	opt->trace_file = NULL;
 	opt->file_in = NULL;
 	opt->file_out = NULL;
-	opt->dict = calloc(2, sizeof(char));
+	opt->max_visits = 0;
+	opt->nice_len = 0;
+	opt->max_depth = 0;
+	opt->batch = 0;
+	opt->jobs = 0;
+	opt->solid = 0;
+	opt->restart = ARCHIVE_RESTART;
+	opt->extract = NULL;
+	opt->quiet = 0;
+	opt->exclusive = 0;
+	opt->pipeline = 1;
+	opt->io_uring = 0;
+	opt->fast_decode = 0;
+	opt->literal_runs = 1;
+	opt->block_widths = 1;
+	opt->stdout_fd = STDOUT_FILENO;
+	opt->tune = 0;
+	opt->tune_speed = 0;
+	opt->dict = find_dictionary("it");
 	if(opt->dict == NULL)
 		return -1;
-	strncpy(opt->dict,"it",2);
 
 	return 0;
 }
@@ -57,9 +139,9 @@ int init_opt(struct options *opt)
 
 int handle_options(struct options *opt, int argc, char* argv[])
 {
-	char c;
+	int c;
 	
-	while ((c = getopt (argc, argv, "hvcdi:o:w:l:t:")) != -1){
+	while ((c = getopt_long (argc, argv, "hvcdTsi:o:w:l:t:S:", long_options, NULL)) != -1){
 	 	switch(c) {
 	 		case 'c':
 				opt->mode = COMPRESSION;
@@ -67,6 +149,12 @@ int handle_options(struct options *opt, int argc, char* argv[])
 			case 'd':
 				opt->mode = DECOMPRESSION;
 				break;
+			case 'T':
+				opt->mode = TEST;
+				break;
+			case 's':
+				opt->checksum = 1;
+				break;
 
            		case 'i':
                 		// check if exist and the read permission
@@ -74,19 +162,23 @@ int handle_options(struct options *opt, int argc, char* argv[])
 					printf("ERROR!!! The input file %s not exists or you haven't the read permission\n",optarg);
                     			return -1;
 				}
-				opt->file_in = malloc( strlen( optarg ) );
-                		strcpy( opt->file_in, optarg );
+				opt->file_in = strdup( optarg );
+				if(opt->file_in == NULL)
+					return -1;
                 		break;
 
 			case 'o':
 				
 				// check the write permission on the directory and his existence
 				if(file_check(optarg,W_OK) == -1){
-					printf("ERROR!!! The output file %s not exist or you haven't write permission on it.\n",optarg);
+					// overwrite() already said why
+					if(errno != EEXIST)
+						printf("ERROR!!! The output file %s not exist or you haven't write permission on it.\n",optarg);
 					return -1;
                 		}
-				opt->file_out = malloc( strlen( optarg ) );
-				strcpy( opt->file_out, optarg );
+				opt->file_out = strdup( optarg );
+				if(opt->file_out == NULL)
+					return -1;
 				break;
 
 
@@ -94,19 +186,102 @@ int handle_options(struct options *opt, int argc, char* argv[])
 				opt->verbose = 1;
 				break;
 
+			case 'S':
+				opt->stats_file = optarg;
+				break;
+
+			case OPT_TRACE:
+				opt->trace_file = optarg;
+				break;
+
+			case OPT_MAX_VISITS:
+				opt->max_visits = atoi(optarg);
+				if (opt->max_visits < 0){
+					printf("Error : max visits parameter must be positive\n");
+					return -1;
+				}
+				break;
+
+			case OPT_NICE_LENGTH:
+				opt->nice_len = atoi(optarg);
+				if (opt->nice_len < 0){
+					printf("Error : nice length parameter must be positive\n");
+					return -1;
+				}
+				break;
+
+			case OPT_BATCH:
+				opt->batch = 1;
+				break;
+
+			case OPT_JOBS:
+				opt->jobs = atoi(optarg);
+				if (opt->jobs <= 0){
+					printf("Error : jobs parameter must be positive\n");
+					return -1;
+				}
+				break;
+
+			case OPT_SOLID:
+				opt->solid = 1;
+				break;
+
+			case OPT_RESTART:
+				if (optarg[0] == '-'){
+					printf("Error : restart parameter must be positive\n");
+					return -1;
+				}
+				opt->restart = strtoull(optarg, NULL, 10);
+				break;
+
+			case OPT_EXTRACT:
+				opt->extract = optarg;
+				break;
+
+			case OPT_NO_PIPELINE:
+				opt->pipeline = 0;
+				break;
+
+			case OPT_IO_URING:
+				opt->io_uring = 1;
+				break;
+
+			case OPT_FAST_DECODE:
+				opt->fast_decode = 1;
+				break;
+
+			case OPT_NO_LITERAL_RUNS:
+				opt->literal_runs = 0;
+				break;
+
+			case OPT_FIXED_WIDTHS:
+				opt->block_widths = 0;
+				break;
+
+			case OPT_AUTO:
+				opt->tune = 1;
+				opt->tune_speed = strtod(optarg, NULL);
+				if (opt->tune_speed < 0){
+					printf("Error : auto speed parameter must be positive\n");
+					return -1;
+				}
+				break;
+
+			case OPT_MAX_DEPTH:
+				opt->max_depth = atoi(optarg);
+				if (opt->max_depth < 0){
+					printf("Error : max depth parameter must be positive\n");
+					return -1;
+				}
+				break;
+
             		case 't':
-				// dictionary name must be of two chars
-                		if ( strlen(optarg) != 2){
-                    			printf("Error : The dictionary will be only of 2 characters\n");
+				// the dictionaries are compiled in the software
+				opt->dict = find_dictionary(optarg);
+                		if ( opt->dict == NULL){
+					printf("Error : The dictionary %s doesn't exist\n",optarg);
 			                return -1;
                 		}
-                		// check if exist and the read permission
-		                if(file_check(optarg,F_OK|R_OK) == -1){
-					printf("Error : The dictionary %s doesnt exists or you haven't the read permission\n",optarg);
-                			return -1;
-				}
-                		//opt->dict = malloc(strlen(optarg));
-		                strcpy( opt->dict, optarg );
 
 		                break;
 			case 'w':
@@ -115,7 +290,7 @@ int handle_options(struct options *opt, int argc, char* argv[])
 				        printf("Error : window parameter must be positive\n");
                 			return -1;
 	                	}
-				if (opt->window_len >= 32768){
+				if (opt->window_len > MAX_WINDOW_LEN){
 				        printf("Error : window parameter must be at least 32767\n");
                 			return -1;
 	                	}	
@@ -156,13 +331,36 @@ int handle_options(struct options *opt, int argc, char* argv[])
 		printf("Use -h to see hot to use this program.\n");
 		return -1;
        	}
-	if(( opt->file_in == NULL) & (opt->mode == DECOMPRESSION)){
-		printf("In decompression mode the file input can't be the standard input.\n");
+	if( opt->batch && opt->solid ){
+		printf("--batch and --solid can't be used together.\n");
+		return -1;
+	}
+	if( opt->extract != NULL && (!opt->solid || opt->mode == COMPRESSION) ){
+		printf("--extract can be used only to decompress a solid archive.\n");
+		return -1;
+	}
+	if( opt->tune && (opt->mode != COMPRESSION || opt->batch || opt->solid) ){
+		printf("--auto can be used only to compress a single file.\n");
+		return -1;
+	}
+	if( opt->solid && opt->mode == COMPRESSION && opt->file_in != NULL ){
+		printf("In solid mode the files are given after the options, -i can't be used.\n");
+		return -1;
+	}
+	if( opt->batch ){
+		if( opt->file_in != NULL || opt->file_out != NULL ){
+			printf("In batch mode the files are given after the options, -i and -o can't be used.\n");
+			return -1;
+		}
+	}else if( opt->solid && opt->file_in == NULL && opt->mode != COMPRESSION ){
+		// the table is at the end of the archive
+		printf("A solid archive can't be read from the standard input.\n");
 		return -1; 
 	}
 	
-	if(( opt->file_out == NULL) & (opt->mode == COMPRESSION)){
-		printf("In compression mode the file output can't be the standard output\n");
+	if( opt->solid && opt->file_out == NULL && opt->mode == COMPRESSION ){
+		// the archive is removed in case of error
+		printf("A solid archive can't be written on the standard output.\n");
 		return -1; 
 	}
 
@@ -176,31 +374,76 @@ int handle_options(struct options *opt, int argc, char* argv[])
 
 }
 
+int messages_to_stderr(struct options *opt){
+
+	// the batch mode and the solid archives write files
+	if( opt->file_out != NULL || opt->mode == TEST || opt->batch )
+		return 0;
+	if( opt->solid && (opt->mode == COMPRESSION || opt->extract == NULL) )
+		return 0;
+
+	fflush(stdout);
+	opt->stdout_fd = dup(STDOUT_FILENO);
+	if( opt->stdout_fd == -1 )
+		return -1;
+	if( dup2(STDERR_FILENO, STDOUT_FILENO) == -1 )
+		return -1;
+	return 0;
+}
+
 /**
  * Print the fields contained in the option structure
  * 
  * @param opt : option structure that contain the informations to be show
  */
 void print_options(struct options opt){
-	
+
+	// the batch mode and the archives print only their summary
+	if(opt.quiet)
+		return;
+
 	if(opt.verbose){
-		if(opt.mode){
+		if(opt.mode == COMPRESSION){
 			printf("Mode : Compression\n");
-			printf("Dictionary : %s\n",opt.dict);
+			printf("Dictionary : %s\n",opt.dict->name);
 		}
+		else if(opt.mode == TEST)
+			printf("Mode : Test\n");
 		else
 			printf("Mode : Decompression\n");
+		printf("Checksum : %s\n",opt.checksum ? "ON" : "OFF");
+		if(opt.fast_decode)
+			printf("Token format : bytes\n");
+		else
+			printf("Token format : bits%s%s\n", opt.literal_runs ? ", literal runs" : "",
+			       opt.block_widths ? ", block widths" : "");
 		if(opt.verbose)
 			printf("Verbose : ON\n");
+		if(opt.tune)
+			printf("Parameters : chosen by --auto\n");
 		printf("Window size : %d\n",opt.window_len);
 		printf("Look ahead buffer size : %d\n",opt.look_ahead_len);		
+		if(opt.mode == COMPRESSION){
+			printf("Max visits : %d\n",opt.max_visits);
+			printf("Nice length : %d\n",opt.nice_len);
+			printf("Max depth : %d\n",opt.max_depth);
+		}
+		printf("Pipelined I/O : %s\n",!opt.pipeline ? "OFF" : opt.io_uring ? "io_uring" : "ON");
 	}	
 
-	if(opt.file_in == NULL)
+	if(opt.solid && opt.mode == COMPRESSION)
+		printf("Input : Files of the archive\n");
+	else if(opt.file_in == NULL)
 		printf("Input : Standard Input\n");	
 	else
 		printf("File Input : %s\n",opt.file_in);
-	if(opt.file_out == NULL)
+	if(opt.solid && opt.mode == COMPRESSION && opt.restart > 0)
+		printf("Restart points : every %llu bytes\n", (unsigned long long)opt.restart);
+	if(opt.mode == TEST)
+		printf("Output : None\n");
+	else if(opt.solid && opt.mode == DECOMPRESSION && opt.extract == NULL)
+		printf("Output : Files of the archive\n");
+	else if(opt.file_out == NULL)
 		printf("Output : Standard Output\n");
 	else
 		printf("File Output : %s\n",opt.file_out);
@@ -218,16 +461,26 @@ void print_options(struct options opt){
  * @return 		0 for success or -1 in case of error
  */
 int overwrite(char* filename){
-	unsigned char answer;
+	int answer;
 	int ret ;
 	for(;;){
 		// check if there is a file with this name
 		if(access(filename, R_OK)==0){
+			// the standard input can be the data to compress, or nobody can answer
+			if(!isatty(STDIN_FILENO)){
+				printf("%s already exist and it can't be asked if overwrite it.\n",filename);
+				errno = EEXIST;
+				return -1;
+			}
 			printf("\n%s already exist, do you want overwrite it? [y/n] : ",filename);
 			for(;;){
 				//ret = scanf("%c",&answer);
 				answer = getchar();
 
+				if(answer == EOF){
+					errno = EEXIST;
+					return -1;
+				}
 				if(answer == '\n') //ignore it
 					continue;
 				if(answer!='y' && answer!= 'n'){
@@ -0,0 +1,646 @@
+/**
+ * @file pipeline.c
+ *
+ * The queues never fill up because they have more slots than the buffers of
+ * their direction, so a push never waits. A thread that finds its queue
+ * empty spins for a while, then gives the CPU to the others and at the end
+ * sleeps for short periods: when the I/O is the bottleneck the codec doesn't
+ * burn a CPU waiting for it.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "../include/pipeline.h"
+#include "../include/uring.h"
+#include "../include/trace.h"
+
+#define QUEUE_SLOTS 16	// power of two, at least PIPELINE_BUFFERS
+#define SPIN_TRIES 64	// tries before to yield the CPU
+#define YIELD_TRIES 128	// tries before to sleep
+#define NAP_NS 50000	// sleep of a thread waiting for a buffer
+
+/**
+ * A buffer of data
+ *  - len	bytes of data, in the input less than PIPELINE_BUFSIZE only at
+ *		the end and -1 if the read failed
+ *  - error	errno of the read failed
+ *  - last	the last buffer of the output, the writer thread stops after it
+ *  - done	the read of the buffer is complete (io_uring)
+ *  - off	offset of the data in the file (io_uring)
+ */
+struct buffer{
+	int len;
+	int error;
+	int last;
+	int done;
+	uint64_t off;
+	unsigned char data[PIPELINE_BUFSIZE];
+};
+
+/**
+ * Queue with one producer and one consumer, without locks: only the producer
+ * writes tail and only the consumer writes head. The release store of an
+ * index publishes the slot to the other thread. The indexes are in different
+ * cache lines so the two threads don't fight for the same line.
+ */
+struct queue{
+	struct buffer *slots[QUEUE_SLOTS];
+	_Alignas(64) atomic_uint head;
+	_Alignas(64) atomic_uint tail;
+};
+
+/**
+ *  - uring	the threads try io_uring on the regular files
+ *  - in_regular	the input is a regular file, a read of it can't block forever
+ *  - out_regular	the output is a regular file
+ *  - in	buffer being read by pipeline_read(), NULL if it must take the next one
+ *  - in_end	the last buffer of the input was taken
+ *  - out	buffer being filled by pipeline_write()
+ *  - stop	the reader thread must stop
+ *  - out_error	errno of the first write failed, 0 if there isn't
+ *  - pinned	a ring couldn't be drained after an error, the kernel can
+ *		still write in the buffers so they aren't freed
+ */
+struct pipeline{
+	int fd_in;
+	int fd_out;
+	pthread_t reader;
+	pthread_t writer;
+	int has_reader;
+	int has_writer;
+	int uring;
+	int in_regular;
+	int out_regular;
+	struct queue in_full, in_free;
+	struct queue out_full, out_free;
+	struct buffer *in;
+	int in_pos;
+	int in_end;
+	struct buffer *out;
+	atomic_int stop;
+	atomic_int out_error;
+	atomic_int pinned;
+	struct buffer *buffers;
+};
+
+
+static void push(struct queue *q, struct buffer *b)
+{
+	unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+	q->slots[tail % QUEUE_SLOTS] = b;
+	atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+static struct buffer *try_pop(struct queue *q)
+{
+	unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	struct buffer *b;
+
+	if(head == atomic_load_explicit(&q->tail, memory_order_acquire))
+		return NULL;
+	b = q->slots[head % QUEUE_SLOTS];
+	atomic_store_explicit(&q->head, head + 1, memory_order_release);
+	return b;
+}
+
+/**
+ * Wait for a buffer of the queue.
+ *
+ * @param stop	if it isn't NULL the wait ends when *stop becomes 1
+ *
+ * @return	the buffer, NULL if stopped
+ */
+static struct buffer *pop(struct queue *q, atomic_int *stop)
+{
+	struct timespec nap = { 0, NAP_NS };
+	struct buffer *b;
+	int tries = 0;
+
+	while( (b = try_pop(q)) == NULL ){
+		if(stop != NULL && atomic_load(stop))
+			return NULL;
+		tries++;
+		if(tries >= YIELD_TRIES)
+			nanosleep(&nap, NULL);
+		else if(tries >= SPIN_TRIES)
+			sched_yield();
+	}
+	return b;
+}
+
+
+/**
+ * Read n bytes from fd, less only at the end of the file.
+ *
+ * @return	the number of bytes read, -1 in case of error
+ */
+static int read_full(int fd, unsigned char *buf, int n)
+{
+	int done = 0;
+	ssize_t r;
+
+	while(done < n){
+		r = read(fd, buf + done, n - done);
+		if(r == 0)
+			break;
+		if(r == -1){
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += r;
+	}
+	return done;
+}
+
+/**
+ * Write n bytes in fd, write() can write less bytes than requested.
+ *
+ * @return	0 if success, -1 otherwise
+ */
+static int write_full(int fd, const unsigned char *buf, int n)
+{
+	ssize_t r;
+
+	while(n > 0){
+		r = write(fd, buf, n);
+		if(r == -1){
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += r;
+		n -= r;
+	}
+	return 0;
+}
+
+/**
+ * Like write_full() at offset off of the file.
+ */
+static int pwrite_full(int fd, const unsigned char *buf, int n, uint64_t off)
+{
+	ssize_t r;
+
+	while(n > 0){
+		r = pwrite(fd, buf, n, off);
+		if(r == -1){
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += r;
+		off += r;
+		n -= r;
+	}
+	return 0;
+}
+
+/**
+ * Like read_full() at offset off of the file.
+ */
+static int pread_full(int fd, unsigned char *buf, int n, uint64_t off)
+{
+	int done = 0;
+	ssize_t r;
+
+	while(done < n){
+		r = pread(fd, buf + done, n - done, off + done);
+		if(r == 0)
+			break;
+		if(r == -1){
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += r;
+	}
+	return done;
+}
+
+/**
+ * Create a ring for the buffers of a direction, without registered buffers
+ * the operations work anyway.
+ *
+ * @param first		first buffer of the direction
+ */
+static int ring_start(struct uring *ring, struct buffer *first)
+{
+	struct iovec iov[PIPELINE_BUFFERS];
+	int i;
+
+	if(uring_init(ring, PIPELINE_BUFFERS) == -1)
+		return -1;
+	for(i = 0; i < PIPELINE_BUFFERS; i++){
+		iov[i].iov_base = first[i].data;
+		iov[i].iov_len = PIPELINE_BUFSIZE;
+	}
+	uring_register(ring, iov, PIPELINE_BUFFERS);
+	return 0;
+}
+
+/**
+ * Reader thread with io_uring: a read is in flight for each free buffer,
+ * the buffers go to the codec in the order of the file.
+ *
+ * @return	0 if done, -1 if io_uring isn't available and nothing was read
+ */
+static int reader_uring(struct pipeline *p)
+{
+	struct uring ring;
+	struct buffer *order[PIPELINE_BUFFERS];	// buffers not yet given to the codec, in the order of the file
+	struct buffer *b;
+	unsigned first = 0, n = 0;
+	int in_flight = 0;
+	int end = 0;
+	int res, r;
+	off_t off;
+	void *data;
+	uint64_t t;
+
+	off = lseek(p->fd_in, 0, SEEK_CUR);
+	if(off == -1 || ring_start(&ring, p->buffers) == -1)
+		return -1;
+
+	for(;;){
+		// a read for each free buffer
+		while(!end){
+			b = in_flight == 0 ? pop(&p->in_free, &p->stop) : try_pop(&p->in_free);
+			if(b == NULL)
+				break;
+			b->done = 0;
+			b->off = off;
+			uring_prep(&ring, URING_READ, p->fd_in, b->data, PIPELINE_BUFSIZE, off,
+				   b - p->buffers, b);
+			off += PIPELINE_BUFSIZE;
+			order[(first + n) % PIPELINE_BUFFERS] = b;
+			n++;
+			in_flight++;
+		}
+		if(in_flight == 0)
+			break;
+
+		t = trace_begin();
+		if(uring_wait(&ring, &data, &res) == -1){
+			r = errno;
+			// the other reads must end before the buffers are given back
+			if(uring_drain(&ring, in_flight) == -1)
+				atomic_store(&p->pinned, 1);
+			// the buffer at the head gets the error, the codec stops there
+			b = order[first];
+			b->len = -1;
+			b->error = r;
+			push(&p->in_full, b);
+			break;
+		}
+		trace_end("read", t);
+		in_flight--;
+
+		b = data;
+		b->done = 1;
+		b->len = res;
+		b->error = res < 0 ? -res : 0;
+		if(res < 0){
+			b->len = -1;
+		}else if(res < PIPELINE_BUFSIZE && res > 0){
+			// a short read isn't always the end of the file
+			r = pread_full(p->fd_in, b->data + res, PIPELINE_BUFSIZE - res, b->off + res);
+			if(r == -1){
+				b->len = -1;
+				b->error = errno;
+			}else{
+				b->len += r;
+			}
+		}
+
+		if(end)
+			continue;
+		// the reads complete out of order
+		while(n > 0 && order[first]->done){
+			b = order[first];
+			first = (first + 1) % PIPELINE_BUFFERS;
+			n--;
+			push(&p->in_full, b);
+			// end of the input or error, the other reads are only waited
+			if(b->len < PIPELINE_BUFSIZE){
+				end = 1;
+				break;
+			}
+		}
+	}
+
+	uring_exit(&ring);
+	return 0;
+}
+
+/**
+ * Writer thread with io_uring: a write is in flight for each full buffer.
+ *
+ * @return	0 if done, -1 if io_uring isn't available and nothing was written
+ */
+static int writer_uring(struct pipeline *p)
+{
+	struct uring ring;
+	struct buffer *b;
+	int in_flight = 0;
+	int last = 0;
+	int res;
+	off_t off;
+	void *data;
+	uint64_t t;
+
+	// with O_APPEND the offsets of the writes are ignored
+	off = lseek(p->fd_out, 0, SEEK_CUR);
+	if(off == -1 || (fcntl(p->fd_out, F_GETFL) & O_APPEND))
+		return -1;
+	if(ring_start(&ring, p->buffers + PIPELINE_BUFFERS) == -1)
+		return -1;
+
+	while(!last || in_flight > 0){
+		// a write for each full buffer
+		while(!last){
+			b = in_flight == 0 ? pop(&p->out_full, NULL) : try_pop(&p->out_full);
+			if(b == NULL)
+				break;
+			last = b->last;
+			if(b->len == 0 || atomic_load(&p->out_error) != 0){
+				push(&p->out_free, b);
+				continue;
+			}
+			b->off = off;
+			b->done = 0;
+			uring_prep(&ring, URING_WRITE, p->fd_out, b->data, b->len, off,
+				   b - p->buffers - PIPELINE_BUFFERS, b);
+			off += b->len;
+			in_flight++;
+		}
+		if(in_flight == 0)
+			continue;
+
+		t = trace_begin();
+		if(uring_wait(&ring, &data, &res) == -1){
+			atomic_store(&p->out_error, errno);
+			// the other writes must end before the buffers are given back,
+			// then the next ones are only given back until the last
+			if(uring_drain(&ring, in_flight) == -1)
+				atomic_store(&p->pinned, 1);
+			for(b = p->buffers + PIPELINE_BUFFERS; b < p->buffers + 2 * PIPELINE_BUFFERS; b++){
+				if(!b->done){
+					b->done = 1;
+					push(&p->out_free, b);
+				}
+			}
+			in_flight = 0;
+			continue;
+		}
+		trace_end("write", t);
+		in_flight--;
+
+		b = data;
+		b->done = 1;
+		if(res < 0)
+			atomic_store(&p->out_error, -res);
+		else if(res < b->len && pwrite_full(p->fd_out, b->data + res, b->len - res, b->off + res) == -1)
+			atomic_store(&p->out_error, errno);
+		push(&p->out_free, b);
+	}
+
+	// the offset of the file as if it was written by write()
+	lseek(p->fd_out, off, SEEK_SET);
+	uring_exit(&ring);
+	return 0;
+}
+
+static void *reader_main(void *arg)
+{
+	struct pipeline *p = arg;
+	struct buffer *b;
+	uint64_t t;
+
+	trace_thread_name("reader");
+
+	if(p->uring && p->in_regular && reader_uring(p) == 0)
+		return NULL;
+
+	for(;;){
+		b = pop(&p->in_free, &p->stop);
+		if(b == NULL)
+			break;
+
+		t = trace_begin();
+		b->len = read_full(p->fd_in, b->data, PIPELINE_BUFSIZE);
+		b->error = b->len == -1 ? errno : 0;
+		trace_end("read", t);
+
+		push(&p->in_full, b);
+		// end of the input or error
+		if(b->len < PIPELINE_BUFSIZE)
+			break;
+	}
+	return NULL;
+}
+
+static void *writer_main(void *arg)
+{
+	struct pipeline *p = arg;
+	struct buffer *b;
+	uint64_t t;
+	int last;
+
+	trace_thread_name("writer");
+
+	if(p->uring && p->out_regular && writer_uring(p) == 0)
+		return NULL;
+
+	do{
+		b = pop(&p->out_full, NULL);
+		last = b->last;
+
+		// after an error the buffers are only given back
+		if(atomic_load(&p->out_error) == 0){
+			t = trace_begin();
+			if(write_full(p->fd_out, b->data, b->len) == -1)
+				atomic_store(&p->out_error, errno != 0 ? errno : EIO);
+			trace_end("write", t);
+		}
+		push(&p->out_free, b);
+	}while(!last);
+
+	return NULL;
+}
+
+
+struct pipeline *pipeline_start(int fd_in, int fd_out, int flags)
+{
+	struct pipeline *p;
+	struct stat st;
+	int i, err;
+
+	p = calloc(1, sizeof(struct pipeline));
+	if(p == NULL)
+		return NULL;
+	p->buffers = malloc(2 * PIPELINE_BUFFERS * sizeof(struct buffer));
+	if(p->buffers == NULL){
+		free(p);
+		return NULL;
+	}
+	for(i = 0; i < 2 * PIPELINE_BUFFERS; i++)
+		p->buffers[i].done = 1;	// not in flight (writer_uring())
+	for(i = 0; i < PIPELINE_BUFFERS; i++){
+		push(&p->in_free, &p->buffers[i]);
+		push(&p->out_free, &p->buffers[PIPELINE_BUFFERS + i]);
+	}
+	p->fd_in = fd_in;
+	p->fd_out = fd_out;
+	p->uring = (flags & PIPELINE_URING) != 0;
+	p->in_regular = fd_in != -1 && fstat(fd_in, &st) == 0 && S_ISREG(st.st_mode);
+	p->out_regular = fd_out != -1 && fstat(fd_out, &st) == 0 && S_ISREG(st.st_mode);
+	atomic_init(&p->stop, 0);
+	atomic_init(&p->out_error, 0);
+	atomic_init(&p->pinned, 0);
+
+	if(fd_out != -1){
+		p->out = pop(&p->out_free, NULL);
+		p->out->len = 0;
+		p->out->last = 0;
+		err = pthread_create(&p->writer, NULL, writer_main, p);
+		if(err != 0)
+			goto error;
+		p->has_writer = 1;
+	}
+	if(fd_in != -1){
+		err = pthread_create(&p->reader, NULL, reader_main, p);
+		if(err != 0)
+			goto error;
+		p->has_reader = 1;
+	}
+
+	return p;
+
+error:
+	pipeline_finish(p);
+	errno = err;
+	return NULL;
+}
+
+int pipeline_read(void *pipeline, unsigned char *buf, int n)
+{
+	struct pipeline *p = pipeline;
+	int done = 0;
+	int k;
+
+	while(done < n){
+		if(p->in == NULL){
+			if(p->in_end)
+				break;
+			p->in = pop(&p->in_full, NULL);
+			p->in_pos = 0;
+			if(p->in->len < PIPELINE_BUFSIZE)
+				p->in_end = 1;
+			if(p->in->len == -1){
+				errno = p->in->error;
+				push(&p->in_free, p->in);
+				p->in = NULL;
+				return -1;
+			}
+		}
+
+		k = p->in->len - p->in_pos;
+		if(k > n - done)
+			k = n - done;
+		memcpy(buf + done, p->in->data + p->in_pos, k);
+		p->in_pos += k;
+		done += k;
+
+		// give back the buffer to the reader thread
+		if(p->in_pos == p->in->len){
+			push(&p->in_free, p->in);
+			p->in = NULL;
+		}
+	}
+
+	return done;
+}
+
+int pipeline_write(void *pipeline, const unsigned char *buf, int n)
+{
+	struct pipeline *p = pipeline;
+	int error = atomic_load(&p->out_error);
+	int k;
+
+	if(error != 0){
+		errno = error;
+		return -1;
+	}
+
+	while(n > 0){
+		if(p->out->len == PIPELINE_BUFSIZE){
+			push(&p->out_full, p->out);
+			p->out = pop(&p->out_free, NULL);
+			p->out->len = 0;
+			p->out->last = 0;
+		}
+
+		k = PIPELINE_BUFSIZE - p->out->len;
+		if(k > n)
+			k = n;
+		memcpy(p->out->data + p->out->len, buf, k);
+		p->out->len += k;
+		buf += k;
+		n -= k;
+	}
+
+	return 0;
+}
+
+int pipeline_bit_read(void *pipeline, char *buf, int n)
+{
+	return pipeline_read(pipeline, (unsigned char*)buf, n);
+}
+
+int pipeline_bit_write(void *pipeline, char *buf, int n)
+{
+	return pipeline_write(pipeline, (unsigned char*)buf, n) == -1 ? -1 : n;
+}
+
+int pipeline_finish(struct pipeline *p)
+{
+	int error;
+
+	if(p->has_writer){
+		p->out->last = 1;
+		push(&p->out_full, p->out);
+		pthread_join(p->writer, NULL);
+	}
+	if(p->has_reader){
+		atomic_store(&p->stop, 1);
+		// the input wasn't read until the end, the reader thread can be
+		// blocked in read() (a pipe or a terminal)
+		if(!p->in_end && !p->in_regular)
+			pthread_cancel(p->reader);
+		pthread_join(p->reader, NULL);
+	}
+
+	error = atomic_load(&p->out_error);
+	// better a leak than a write of the kernel in memory given to others
+	if(!atomic_load(&p->pinned))
+		free(p->buffers);
+	free(p);
+
+	if(error != 0){
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
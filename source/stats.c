@@ -0,0 +1,100 @@
+/**
+ * @file stats.c
+ *
+ * Counters of encode() and decode(), see stats.h.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#include "../include/stats.h"
+
+
+void stats_match(struct lz77_stats *stats, int length, int offset)
+{
+	int bucket = 0;
+
+	stats->length_hist[ length & 0xff ]++;
+
+	while(offset > 1 && bucket < OFFSET_BUCKETS - 1){
+		offset >>= 1;
+		bucket++;
+	}
+	stats->offset_hist[ bucket ]++;
+}
+
+/**
+ * Print a histogram as a JSON object with only the buckets different from zero.
+ */
+static void print_hist(FILE *file, const char *name, const uint64_t *hist, int n, int log_buckets)
+{
+	int i, first = 1;
+
+	fprintf(file, "  \"%s\": {", name);
+	for(i = 0; i < n; i++){
+		if(hist[i] == 0)
+			continue;
+		fprintf(file, "%s\"%d\": %llu", first ? "" : ", ", log_buckets ? 1 << i : i, (unsigned long long)hist[i]);
+		first = 0;
+	}
+	fprintf(file, "}");
+}
+
+#define FIELD(name) fprintf(file, "  \"" #name "\": %llu,\n", (unsigned long long)stats->name)
+
+void stats_print_json(FILE *file, const struct lz77_stats *stats, int encoder)
+{
+	fprintf(file, "{\n");
+	fprintf(file, "  \"mode\": \"%s\",\n", encoder ? "compression" : "decompression");
+
+	if(encoder){
+		FIELD(searches);
+		FIELD(search_visits);
+		fprintf(file, "  \"search_avg_visits\": %.2f,\n", stats->searches ? (double)stats->search_visits / stats->searches : 0);
+		FIELD(search_max_visits);
+		FIELD(inserts);
+		FIELD(insert_visits);
+		FIELD(search_cutoffs);
+		FIELD(insert_skips);
+		FIELD(runs);
+		FIELD(deletes);
+		FIELD(bits_header);
+		FIELD(bits_length);
+		FIELD(bits_position);
+		FIELD(bits_literal);
+		FIELD(bits_code);
+		FIELD(bits_checksum);
+	}
+
+	FIELD(literals);
+	FIELD(matches);
+	FIELD(forwards);
+	FIELD(literal_runs);
+	FIELD(stored);
+	FIELD(blocks);
+	FIELD(width_blocks);
+	FIELD(literal_bytes);
+	FIELD(match_bytes);
+	FIELD(stored_bytes);
+	print_hist(file, "length_hist", stats->length_hist, 256, 0);
+	fprintf(file, ",\n");
+	print_hist(file, "offset_hist", stats->offset_hist, OFFSET_BUCKETS, 1);
+	fprintf(file, "\n}\n");
+}
+
+int stats_report(const struct lz77_stats *stats, int encoder, int verbose, const char *filename)
+{
+	FILE *file;
+
+	if(verbose)
+		stats_print_json(stderr, stats, encoder);
+
+	if(filename != NULL){
+		file = fopen(filename, "w");
+		if(file == NULL)
+			return -1;
+		stats_print_json(file, stats, encoder);
+		fclose(file);
+	}
+
+	return 0;
+}
@@ -0,0 +1,221 @@
+/**
+ * @file trace.c
+ *
+ * Chrome trace-event output, see trace.h.
+ * Each thread has its own buffer of events, the buffers are registered in
+ * a global array using an atomic counter, so there aren't locks.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "../include/trace.h"
+
+#define MAX_THREADS 256
+
+struct event{
+	const char *name;
+	uint64_t ts;
+	uint64_t dur;
+	int has_counters;
+	uint64_t counters[TRACE_COUNTERS];
+};
+
+struct trace_buffer{
+	int tid;
+	const char *thread_name;
+	struct event *events;
+	int n_events;
+	int size;
+	uint64_t counters[TRACE_COUNTERS];
+};
+
+int trace_enabled = 0;
+
+static char *trace_filename;
+static uint64_t trace_start;
+static struct trace_buffer *buffers[MAX_THREADS];
+static int n_buffers;
+static __thread struct trace_buffer *local;
+
+static const char *counter_names[TRACE_COUNTERS] = { "match_us", "tree_us", "emit_us", "flush_us" };
+
+
+uint64_t trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Return the buffer of the current thread, it's created at the first call.
+ */
+static struct trace_buffer* get_buffer(void)
+{
+	int index;
+
+	if(local != NULL)
+		return local;
+
+	index = __atomic_fetch_add(&n_buffers, 1, __ATOMIC_SEQ_CST);
+	if(index >= MAX_THREADS)
+		return NULL;
+
+	local = calloc(1, sizeof(struct trace_buffer));
+	if(local == NULL)
+		return NULL;
+	local->tid = (int)syscall(SYS_gettid);
+	__atomic_store_n(&buffers[index], local, __ATOMIC_RELEASE);
+
+	return local;
+}
+
+static struct event* new_event(struct trace_buffer *b)
+{
+	if(b->n_events == b->size){
+		int size = b->size ? b->size * 2 : 1024;
+		struct event *events = realloc(b->events, size * sizeof(struct event));
+
+		if(events == NULL)
+			return NULL;
+		b->events = events;
+		b->size = size;
+	}
+	return &b->events[ b->n_events++ ];
+}
+
+
+int trace_open(const char *filename)
+{
+	if(filename == NULL){
+		errno = EINVAL;
+		return -1;
+	}
+
+	trace_filename = strdup(filename);
+	if(trace_filename == NULL)
+		return -1;
+	trace_start = trace_now();
+	trace_enabled = 1;
+	trace_thread_name("main");
+
+	return 0;
+}
+
+void trace_end(const char *name, uint64_t begin)
+{
+	struct trace_buffer *b;
+	struct event *e;
+
+	if(!trace_enabled || (b = get_buffer()) == NULL || (e = new_event(b)) == NULL)
+		return;
+
+	e->name = name;
+	e->ts = begin;
+	e->dur = trace_now() - begin;
+	e->has_counters = 0;
+}
+
+void trace_counter_add(int counter, uint64_t ns)
+{
+	struct trace_buffer *b;
+
+	if(!trace_enabled || (b = get_buffer()) == NULL)
+		return;
+
+	b->counters[counter] += ns;
+}
+
+void trace_block(const char *name, uint64_t begin)
+{
+	struct trace_buffer *b;
+	struct event *e;
+
+	if(!trace_enabled || (b = get_buffer()) == NULL || (e = new_event(b)) == NULL)
+		return;
+
+	e->name = name;
+	e->ts = begin;
+	e->dur = trace_now() - begin;
+	e->has_counters = 1;
+	memcpy(e->counters, b->counters, sizeof(e->counters));
+	memset(b->counters, 0, sizeof(b->counters));
+}
+
+void trace_thread_name(const char *name)
+{
+	struct trace_buffer *b;
+
+	if(!trace_enabled || (b = get_buffer()) == NULL)
+		return;
+	b->thread_name = name;
+}
+
+
+int trace_close(void)
+{
+	FILE *file;
+	int i, j, k, first = 1;
+	int n;
+
+	if(!trace_enabled)
+		return 0;
+	trace_enabled = 0;
+
+	file = fopen(trace_filename, "w");
+	free(trace_filename);
+	if(file == NULL)
+		return -1;
+
+	n = n_buffers < MAX_THREADS ? n_buffers : MAX_THREADS;
+	fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+	for(i = 0; i < n; i++){
+		struct trace_buffer *b = buffers[i];
+
+		if(b == NULL)
+			continue;
+
+		if(b->thread_name != NULL){
+			fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+				first ? "" : ",\n", (int)getpid(), b->tid, b->thread_name);
+			first = 0;
+		}
+
+		for(j = 0; j < b->n_events; j++){
+			struct event *e = &b->events[j];
+
+			// the time unit of the format is the microsecond
+			fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+				first ? "" : ",\n", e->name, (int)getpid(), b->tid,
+				(e->ts - trace_start) / 1000.0, e->dur / 1000.0);
+			first = 0;
+
+			if(e->has_counters){
+				fprintf(file, ", \"args\": {");
+				for(k = 0; k < TRACE_COUNTERS; k++)
+					fprintf(file, "%s\"%s\": %.3f", k ? ", " : "", counter_names[k], e->counters[k] / 1000.0);
+				fprintf(file, "}");
+			}
+			fprintf(file, "}");
+		}
+
+		free(b->events);
+		free(b);
+		buffers[i] = NULL;
+	}
+
+	fprintf(file, "\n]}\n");
+	n_buffers = 0;
+	local = NULL;
+
+	return fclose(file);
+}
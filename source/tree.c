@@ -12,9 +12,28 @@
  * The nodes are memorized in a circular array, given the index of the substring in the window it's
  * index in the array is given by
  *
- *		(index_string MOD look_ahead_length) + 1
+ *		((index_string + offset) MOD window_length) + 1
  *
- * The plus one it's used to avoid to replace the ROOT.
+ * The plus one it's used to avoid to replace the ROOT. The offset is changed by
+ * move_tree() when the encoder moves back the window, so the tree isn't built
+ * again after each refill.
+ *
+ * The strings are compared in the window array as they are (no wrap-around):
+ * so the order of the nodes doesn't change while the window slides and each
+ * node can keep the first bytes of its string (the key), most of the
+ * comparisons don't need to read the window.
+ *
+ * The tree is a treap: besides the order of the strings each node has a
+ * priority (a hash of its index in the array) and a father has always a
+ * priority greater than its sons. add_node() and delete_node() keep this
+ * property with rotations, so the depth of the tree is logarithmic (in the
+ * expected case) whatever the order of the strings is. Without it sorted or
+ * repetitive data (long runs of zeros, the dictionary repeated by
+ * load_dictionary()) make the tree a list and every search is O(window length).
+ *
+ * If the window has a max depth (w->max_depth) add_node() doesn't insert the
+ * strings that would land deeper: the node stays out of the tree (father
+ * UNUSED and it isn't the real root) and delete_node() ignores it.
  *
  * @author Pischedda Alessandro
  */
@@ -22,224 +41,275 @@
 #include "../include/tree.h"
 
 
-struct Node* build_tree(int length)
+/**
+ * Priority of a node in the treap, it's a hash (finalizer of MurmurHash3)
+ * of the index so it doesn't need memory and it doesn't depend on the data.
+ */
+static inline uint32_t priority(int node)
+{
+	uint32_t h = node;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+/**
+ * Move node in the place of its father with a rotation, the father becomes
+ * a son of node. The order of the strings isn't changed.
+ */
+static void rotate_up(struct tree *tree, int node)
+{
+	struct Node *nodes = tree->nodes;
+	int father = tree->father[ node ];
+	int grandfather = tree->father[ father ];
+	int moved;
+
+	if( nodes[ father ].smaller == node ){ // right rotation
+		moved = nodes[ node ].greater;
+		nodes[ father ].smaller = moved;
+		nodes[ node ].greater = father;
+	}else{ // left rotation
+		moved = nodes[ node ].smaller;
+		nodes[ father ].greater = moved;
+		nodes[ node ].smaller = father;
+	}
+	if( moved != UNUSED )
+		tree->father[ moved ] = father;
+
+	tree->father[ father ] = node;
+	tree->father[ node ] = grandfather;
+
+	// the ROOT uses only its greater field
+	if( grandfather != ROOT && nodes[ grandfather ].smaller == father )
+		nodes[ grandfather ].smaller = node;
+	else
+		nodes[ grandfather ].greater = node;
+}
+
+
+struct tree* build_tree(int length)
 {
-	if(length <= 0){
+	struct tree *tree;
+
+	if(length <= 0 || length > UINT16_MAX - 1){
 		errno = EINVAL;
 		return NULL;
 	}
+
+	tree = calloc(1, sizeof(struct tree));
+	if(tree == NULL)
+		return NULL;
+	tree->n_nodes = length;
+	tree->offset = 0;
+
 	// set automatically all nodes as UNUSED
-	return calloc( (length + 1), sizeof(struct Node) );
+	tree->nodes = calloc( (length + 1), sizeof(struct Node) );
+	tree->father = calloc( (length + 1), sizeof(uint16_t) );
+	if(tree->nodes == NULL || tree->father == NULL){
+		free_tree(tree);
+		return NULL;
+	}
 
+	return tree;
 }
 
-void add_node( struct Node *tree, int new_node, const struct window *w)
+void free_tree(struct tree *tree)
 {
+	if(tree == NULL)
+		return;
+	free(tree->nodes);
+	free(tree->father);
+	free(tree);
+}
+
+void add_node( struct tree *tree, int new_node, const struct window *w)
+{
+	struct Node *nodes = tree->nodes;
 	int current_node;
-	int win_position;
 	int new_node_position;
+	int dict_node;
+	int visits = 0;
+	int diff;
+	uint32_t key;
 
-	new_node_position = ( new_node % w->window_length ) +1; // +1 because of ROOT node
+	new_node_position = node_index(tree, new_node);
+	key = string_key(w->window + new_node);
+
+	nodes[ new_node_position ].key = key;
+	nodes[ new_node_position ].greater = UNUSED;
+	nodes[ new_node_position ].smaller = UNUSED;
 
    	// is it the "real" root ?
-	if( tree[ ROOT ].greater == UNUSED)
+	if( nodes[ ROOT ].greater == UNUSED)
 	{
-		tree[ ROOT ].greater = new_node_position;
-		tree[ new_node_position ].father = ROOT;
-		tree[ new_node_position ].position = new_node;
+		nodes[ ROOT ].greater = new_node_position;
+		tree->father[ new_node_position ] = ROOT;
+		if(w->stats != NULL)
+			w->stats->inserts++;
 		return;
 	}
 
+	dict_node = node_index(tree, w->dict_position);
+
     	// well the root alredy exsist so find a place for the new node
-	current_node = tree[ ROOT ].greater;
+	current_node = nodes[ ROOT ].greater;
 
 	for(;;)
 	{
-		win_position = tree[ current_node ].position;
+		visits++;
+
+		// load both sons while this node is compared
+		prefetch(&nodes[ nodes[ current_node ].smaller ]);
+		prefetch(&nodes[ nodes[ current_node ].greater ]);
+
+		// too deep, the string isn't inserted
+		if( w->max_depth > 0 && visits > w->max_depth ){
+			tree->father[ new_node_position ] = UNUSED;
+			if(w->stats != NULL){
+				w->stats->insert_skips++;
+				w->stats->insert_visits += visits - 1;
+			}
+			return;
+		}
+
+		// the window is read only if the keys are equal
+		if( nodes[ current_node ].key != key )
+			diff = nodes[ current_node ].key > key ? 1 : -1;
+		else
+			diff = window_cmp(w, node_position(tree, current_node, w->dict_position, dict_node), new_node);
 
         	// the new node is smaller than current_node, so go left
-		if ( window_cmp(w, win_position, new_node) > 0 )
+		if ( diff > 0 )
 		{
 
             		// free location ?
-			if( tree[ current_node ].smaller == UNUSED)
+			if( nodes[ current_node ].smaller == UNUSED)
 			{
-				tree[ current_node ].smaller = new_node_position;
+				nodes[ current_node ].smaller = new_node_position;
 				break;
 
 			}
-			current_node = tree[ current_node ].smaller;
+			current_node = nodes[ current_node ].smaller;
 
 		}else{ // the new node is greater than current_node so go right
 
-			if(tree[ current_node ].greater == UNUSED)
+			if(nodes[ current_node ].greater == UNUSED)
 			{
-				tree[ current_node ].greater = new_node_position;
+				nodes[ current_node ].greater = new_node_position;
 				break;
 			}
-			current_node = tree[ current_node ].greater;
+			current_node = nodes[ current_node ].greater;
 
 		}
 
 
 	}
 
-	tree[ new_node_position ].father = current_node;
-	tree[ new_node_position ].position = new_node;
-	tree[ new_node_position ].greater = UNUSED;
-	tree[ new_node_position ].smaller = UNUSED;
+	tree->father[ new_node_position ] = current_node;
 
+	// restore the priorities: the new leaf goes up while it's greater than its father
+	while( tree->father[ new_node_position ] != ROOT &&
+	       priority(new_node_position) > priority(tree->father[ new_node_position ]) )
+		rotate_up(tree, new_node_position);
+
+	if(w->stats != NULL){
+		w->stats->inserts++;
+		w->stats->insert_visits += visits;
+	}
 }
 
 
 
-void level_up(struct Node *tree, int old_node, int new_node )
+void level_up(struct tree *tree, int old_node, int new_node )
 {
+	struct Node *nodes = tree->nodes;
+	int father = tree->father[ old_node ];
 
-	tree[ new_node ].father = tree[ old_node ].father;
+	tree->father[ new_node ] = father;
 	// Update the old_node's father info.
-        if( tree[ tree[ old_node ].father ].smaller == old_node )
-		tree[ tree[ old_node ].father ].smaller = new_node;
+        if( father != ROOT && nodes[ father ].smaller == old_node )
+		nodes[ father ].smaller = new_node;
 	else
-		tree[ tree[ old_node ].father ].greater = new_node;
+		nodes[ father ].greater = new_node;
 
-	tree[ old_node ].father = UNUSED;
-	tree[ old_node ].smaller = UNUSED;
-	tree[ old_node ].greater = UNUSED;
-	// position should be unused too
+	tree->father[ old_node ] = UNUSED;
+	nodes[ old_node ].smaller = UNUSED;
+	nodes[ old_node ].greater = UNUSED;
 }
 
 
-void replace_node(struct Node *tree, int old_node, int new_node)
+void delete_node( struct tree *tree, int node )
 {
-	int father;
-	int greater;
-
-	// Update info old_node's father
-	father = tree[ old_node ].father;
-	if ( tree[ father ].greater == old_node )
-		tree[ father ].greater = new_node;
-	else
-		tree[ father ].smaller = new_node;
-
-	// update tree[ old_node ].greater info.
-	greater = tree[ old_node ].greater;
-	tree[ greater ].father = new_node;
-
-	if( tree[ old_node ].smaller == new_node)
-		tree[ new_node ].father = father;
-	else{ // must update info about new_node's left-son and father
-
-		int smaller;
-		int father_new_node;
-
-		smaller = tree[ old_node ].smaller;
-		tree[ smaller ].father = new_node;
+	struct Node *nodes = tree->nodes;
+	int node_position;
+	int smaller, greater;
 
-		if( tree[ new_node ].smaller != UNUSED ){
+	node_position = node_index(tree, node);
 
-			smaller = tree[new_node].smaller;
-			tree[ smaller ].father = tree[ new_node ].father;
+	// the node was left out of the tree by add_node() (max depth)
+	if( tree->father[ node_position ] == UNUSED && nodes[ ROOT ].greater != node_position )
+		return;
 
-		}
-		father_new_node = tree[new_node].father;
-		tree[father_new_node].greater = tree[new_node].greater;
-		tree[ new_node ].smaller = tree[ old_node ].smaller;
+	// move the node down, rotating up its son with the greater priority,
+	// until it has at most one son
+	for(;;){
+		smaller = nodes[ node_position ].smaller;
+		greater = nodes[ node_position ].greater;
+		if( smaller == UNUSED || greater == UNUSED )
+			break;
+		rotate_up(tree, priority(smaller) > priority(greater) ? smaller : greater);
 	}
 
-
-	// update new_node's information
-	tree[ new_node ].greater = tree[ old_node ].greater; // right son
-	tree[ new_node ].father = tree[ old_node ].father;
-
-	// "delete" old_node
-	tree[ old_node ].father = UNUSED;
-	tree[ old_node ].smaller = UNUSED;
-	tree[ old_node ].greater = UNUSED;
-
-}
-
-int find_max_son(struct Node *tree, int node){
-
-	int greatest = tree[node].smaller;
-	while ( tree[greatest].greater != UNUSED)
-		greatest = tree[greatest].greater;
-
-	return greatest;
-
-}
-
-void delete_node( struct Node *tree, int node, int n_nodes )
-{
-	int node_position;
-
-	node_position = ( node % n_nodes ) +1; // +1 because of ROOT node
-
 	// it's a leaf
-	if( tree[ node_position ].smaller == UNUSED && tree[ node_position ].greater == UNUSED)
+	if( smaller == UNUSED && greater == UNUSED)
 	{
-		//printf("delete leaf - node %d\n",node_position);
-		int father = tree[node_position].father;
+		int father = tree->father[ node_position ];
 
-		// update father informations		
-		if(tree[father].smaller == node_position)
-			tree[father].smaller = UNUSED;
+		// update father informations
+		if( father != ROOT && nodes[ father ].smaller == node_position)
+			nodes[ father ].smaller = UNUSED;
 		else
-			tree[father].greater = UNUSED;
+			nodes[ father ].greater = UNUSED;
 		// update node informations
-		tree[node_position].father = UNUSED;
+		tree->father[ node_position ] = UNUSED;
 		return;
 	}
 
-	if ( tree[ node_position ].greater == UNUSED )
-		level_up(tree, node_position, tree[ node_position ].smaller );
+	if ( greater == UNUSED )
+		level_up(tree, node_position, smaller );
+	else
+		level_up(tree, node_position, greater );
 
-	else if	( tree[ node_position ].smaller == UNUSED )
-		level_up(tree, node_position, tree[ node_position ].greater );
+}
 
-	else{ // replace the node with the max left son
-		//printf("replace ");
-		int max_son;
-		max_son = find_max_son(tree, node_position);
-		//printf(" %d with %d\n",node_position,max_son);
-		replace_node(tree, node_position, max_son);
-	}
+void empty_tree(struct tree *tree){
 
+	memset(tree->nodes, 0, (tree->n_nodes + 1) * sizeof(struct Node));
+	memset(tree->father, 0, (tree->n_nodes + 1) * sizeof(uint16_t));
+	tree->offset = 0;
 }
 
-void empty_tree(struct Node *tree, int n_nodes){
-	int i;
+void move_tree(struct tree *tree, int shift){
 
-	tree[ROOT].greater = UNUSED;
-	for(i = 0; i<=n_nodes; i++){
-		tree[i].father = UNUSED;
-		tree[i].smaller = UNUSED;
-		tree[i].greater = UNUSED;
-		tree[i].position = UNUSED;
-	}
+	tree->offset = ( tree->offset + shift ) % tree->n_nodes;
 }
 
 
 
 int window_cmp(const struct window *w, int s1_head, int s2_head)
 {
-	int i;
-	int s1_i, s2_i;
-	int diff;
+	int length = w->look_ah_length;
+	int last = s1_head > s2_head ? s1_head : s2_head;
 
-	diff=0; 
-	
-	for(i = 0; i < w->look_ah_length; i++){
-		s1_i = wrap( s1_head + i, w->window_length + w->dict_position , w->dict_position);
-		s2_i = wrap( s2_head + i, w->window_length + w->dict_position , w->dict_position);
+	// don't go out of the window array
+	if( last + length > w->window_length * K )
+		length = w->window_length * K - last;
 
-		diff = w->window[ s1_i ] - w->window[ s2_i ];
-		if (diff != 0)
-			break;
-	}
-
-	return diff;
+	return memcmp(w->window + s1_head, w->window + s2_head, length);
 }
 
 
-
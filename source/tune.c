@@ -0,0 +1,426 @@
+/**
+ * @file tune.c
+ *
+ * The slices are read once with pread(), so the input is still at its
+ * start for the compression. The candidates are shared by the threads like
+ * the files of the batch mode: each thread takes the next one under a mutex
+ * and compresses all the slices with its own context, after loading the
+ * dictionary (it isn't measured, a real run loads it only once).
+ *
+ * @author Pischedda Alessandro
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "../include/tune.h"
+#include "../include/lz77.h"
+#include "../include/bitio.h"
+#include "../include/trace.h"
+
+// search effort limits of the fast mode, the ones of the fast benchmark
+#define TUNE_FAST_VISITS 48
+#define TUNE_FAST_NICE 32
+#define TUNE_FAST_DEPTH 48
+
+static const int tune_windows[] = { 1024, 4096, 32767 };
+static const int tune_look_aheads[] = { 16, 64, 255 };
+static const char *tune_dictionaries[] = { "it", "en", "cc" };
+
+#define N_WINDOWS (int)(sizeof(tune_windows) / sizeof(tune_windows[0]))
+#define N_LOOK_AHEADS (int)(sizeof(tune_look_aheads) / sizeof(tune_look_aheads[0]))
+#define N_DICTIONARIES (int)(sizeof(tune_dictionaries) / sizeof(tune_dictionaries[0]))
+
+/**
+ * A set of parameters and its result on the slices.
+ *  - slices	how many slices to compress, from the first
+ *  - first_out	compressed bytes of the first slice
+ *  - seconds	CPU time of the compression of the slices
+ */
+struct candidate{
+	int window_len;
+	int look_ahead_len;
+	const struct dictionary *dict;
+	int fast;
+	int slices;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t first_out;
+	double seconds;
+	int error;
+};
+
+/**
+ * State shared by the threads, only next is written (under lock).
+ */
+struct tune{
+	struct options opt;
+	unsigned char *data;	// the slices one after the other
+	int slice_len[TUNE_SLICES];
+	int n_slices;
+	struct candidate *candidates;
+	int n;
+	int next;	// next candidate to do
+	pthread_mutex_t lock;
+};
+
+/**
+ * Input of encode_stream(): a slice in memory.
+ */
+struct slice_input{
+	const unsigned char *data;
+	int len;
+	int pos;
+};
+
+static int slice_read(void *arg, unsigned char *buf, int n)
+{
+	struct slice_input *s = arg;
+
+	if(n > s->len - s->pos)
+		n = s->len - s->pos;
+	memcpy(buf, s->data + s->pos, n);
+	s->pos += n;
+	return n;
+}
+
+/**
+ * Output of the bitfile: the data is only counted, arg points to the counter.
+ */
+static int count_write(void *arg, char *buf, int n)
+{
+	(void)buf;
+	*(uint64_t*)arg += n;
+	return n;
+}
+
+
+/**
+ * Read the slices of the input fd in t->data.
+ *
+ * @return	the bytes read, -1 in case of error
+ */
+static int tune_sample(struct tune *t, int fd)
+{
+	struct stat st;
+	off_t size, offset;
+	int i, len, total = 0;
+	ssize_t n;
+
+	if(fstat(fd, &st) == -1)
+		return -1;
+	if(!S_ISREG(st.st_mode)){
+		printf("Error : --auto needs a file as input, it can't sample a pipe or a terminal\n");
+		errno = EINVAL;
+		return -1;
+	}
+	size = st.st_size;
+
+	// a small input is a single slice
+	if(size <= (off_t)TUNE_SLICES * TUNE_SLICE){
+		t->n_slices = 1;
+		t->slice_len[0] = size;
+	}else{
+		t->n_slices = TUNE_SLICES;
+		for(i = 0; i < TUNE_SLICES; i++)
+			t->slice_len[i] = TUNE_SLICE;
+	}
+	for(i = 0; i < t->n_slices; i++)
+		total += t->slice_len[i];
+
+	t->data = malloc(total > 0 ? total : 1);
+	if(t->data == NULL)
+		return -1;
+
+	total = 0;
+	for(i = 0; i < t->n_slices; i++){
+		offset = t->n_slices == 1 ? 0 : (size - TUNE_SLICE) * i / (t->n_slices - 1);
+		for(len = 0; len < t->slice_len[i]; len += n){
+			n = pread(fd, t->data + total + len, t->slice_len[i] - len, offset + len);
+			if(n == -1 && errno == EINTR){
+				n = 0;
+				continue;
+			}
+			if(n <= 0){
+				// the file is shorter than fstat() said
+				if(n == 0)
+					errno = EIO;
+				return -1;
+			}
+		}
+		total += t->slice_len[i];
+	}
+	return total;
+}
+
+/**
+ * The options of a candidate.
+ */
+static struct options candidate_options(const struct tune *t, const struct candidate *c)
+{
+	struct options opt = t->opt;
+
+	opt.window_len = c->window_len;
+	opt.look_ahead_len = c->look_ahead_len;
+	opt.dict = c->dict;
+	if(c->fast){
+		opt.max_visits = TUNE_FAST_VISITS;
+		opt.nice_len = TUNE_FAST_NICE;
+		opt.max_depth = TUNE_FAST_DEPTH;
+	}
+	opt.verbose = 0;
+	opt.stats_file = NULL;
+	opt.quiet = 1;
+	return opt;
+}
+
+/**
+ * Compress the slices of a candidate and set its result.
+ */
+static void tune_candidate(struct tune *t, struct candidate *c)
+{
+	struct options opt = candidate_options(t, c);
+	struct lz77_context *ctx;
+	struct lz77_preload *pre;
+	struct bitfile *out;
+	struct slice_input in;
+	struct timespec start, end;
+	const unsigned char *data = t->data;
+	uint64_t bytes = 0;
+	int i, ret = 0;
+
+	c->error = 1;
+	ctx = lz77_context_create(COMPRESSION, opt.window_len);
+	pre = encode_preload(opt);
+	if(ctx == NULL || pre == NULL)
+		goto end;
+	ctx->preload = pre;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	for(i = 0; i < c->slices && ret != -1; i++){
+		in.data = data;
+		in.len = t->slice_len[i];
+		in.pos = 0;
+		out = bit_open_io_at(count_write, &bytes, BIT_WR, CONTEXT_BUFSIZE, ctx->bitfile);
+		if(out == NULL)
+			goto end;
+		ret = encode_stream(ctx, opt, &(struct lz77_input){ slice_read, &in }, out, NULL);
+		if(bit_close(out) == -1)
+			ret = -1;
+		if(i == 0)
+			c->first_out = bytes;
+		c->bytes_in += in.len;
+		data += in.len;
+	}
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+	c->bytes_out = bytes;
+	c->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	c->error = ret == -1;
+
+end:
+	lz77_preload_free(pre);
+	lz77_context_free(ctx);
+}
+
+static void *tune_worker(void *arg)
+{
+	struct tune *t = arg;
+	int i;
+
+	trace_thread_name("tune worker");
+
+	for(;;){
+		pthread_mutex_lock(&t->lock);
+		i = t->next++;
+		pthread_mutex_unlock(&t->lock);
+		if(i >= t->n)
+			break;
+		tune_candidate(t, &t->candidates[i]);
+	}
+
+	return NULL;
+}
+
+/**
+ * Compress the n candidates with a thread for each CPU (or opt.jobs).
+ *
+ * @return	0 if successfully work and -1 if something goes wrong.
+ */
+static int tune_run(struct tune *t, struct candidate *candidates, int n)
+{
+	pthread_t *threads;
+	int jobs, started, i;
+
+	jobs = t->opt.jobs;
+	if(jobs == 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if(jobs > n)
+		jobs = n;
+	if(jobs < 1)
+		jobs = 1;
+
+	threads = calloc(jobs, sizeof(pthread_t));
+	if(threads == NULL)
+		return -1;
+
+	t->candidates = candidates;
+	t->n = n;
+	t->next = 0;
+	// a single CPU doesn't need a thread, and if a thread can't be created
+	// the ones already started do all the candidates
+	for(started = 0; jobs > 1 && started < jobs; started++){
+		if(pthread_create(&threads[started], NULL, tune_worker, t) != 0)
+			break;
+	}
+	if(started == 0)
+		tune_worker(t);
+	for(i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	return 0;
+}
+
+/**
+ * Speed of a candidate in MB/s.
+ */
+static double candidate_speed(const struct candidate *c)
+{
+	return c->seconds > 0 ? c->bytes_in / c->seconds / 1e6 : 1e9;
+}
+
+static const char *mode_name(const struct candidate *c)
+{
+	return c->fast ? "fast" : "plain";
+}
+
+/**
+ * Return the candidate with the smallest output among the ones at least
+ * speed MB/s fast, or the fastest one if none of them is. NULL if all of
+ * them failed.
+ */
+static struct candidate *tune_best(struct candidate *candidates, int n, double speed)
+{
+	struct candidate *best = NULL, *fastest = NULL, *c;
+	int i;
+
+	for(i = 0; i < n; i++){
+		c = &candidates[i];
+		if(c->error)
+			continue;
+		if(fastest == NULL || candidate_speed(c) > candidate_speed(fastest))
+			fastest = c;
+		if(candidate_speed(c) >= speed && (best == NULL || c->bytes_out < best->bytes_out))
+			best = c;
+	}
+	return best != NULL ? best : fastest;
+}
+
+
+int tune_options(struct options *opt)
+{
+	struct tune t;
+	struct candidate grid[N_WINDOWS * N_LOOK_AHEADS * 2];
+	struct candidate dicts[N_DICTIONARIES];
+	struct candidate *best;
+	int n = 0, n_dicts = 0;
+	int fd, w, l, mode, i;
+	int ret = -1;
+
+	memset(&t, 0, sizeof(t));
+	t.opt = *opt;
+	pthread_mutex_init(&t.lock, NULL);
+
+	if(opt->file_in == NULL){
+		fd = STDIN_FILENO;
+	}else{
+		fd = open(opt->file_in, O_RDONLY);
+		if(fd == -1)
+			goto end;
+	}
+	ret = tune_sample(&t, fd);
+	if(opt->file_in != NULL)
+		close(fd);
+	if(ret <= 0){
+		// an empty input has nothing to choose
+		goto end;
+	}
+	ret = -1;
+
+	// window length, look ahead length and mode on all the slices
+	memset(grid, 0, sizeof(grid));
+	for(w = 0; w < N_WINDOWS; w++)
+		for(l = 0; l < N_LOOK_AHEADS; l++)
+			for(mode = 0; mode < 2; mode++){
+				grid[n].window_len = tune_windows[w];
+				grid[n].look_ahead_len = tune_look_aheads[l];
+				grid[n].dict = opt->dict;
+				grid[n].fast = mode;
+				grid[n].slices = t.n_slices;
+				n++;
+			}
+	if(tune_run(&t, grid, n) == -1)
+		goto end;
+	for(i = 0; opt->verbose && i < n; i++){
+		if(grid[i].error)
+			continue;
+		printf("Auto : -w %d -l %d %s : %llu -> %llu bytes, %.2f MB/s\n",
+		       grid[i].window_len, grid[i].look_ahead_len, mode_name(&grid[i]),
+		       (unsigned long long)grid[i].bytes_in, (unsigned long long)grid[i].bytes_out,
+		       candidate_speed(&grid[i]));
+	}
+	best = tune_best(grid, n, opt->tune_speed);
+	if(best == NULL){
+		printf("Error : --auto can't compress the samples of the input\n");
+		goto end;
+	}
+
+	// the dictionary is used only at the start of the file
+	memset(dicts, 0, sizeof(dicts));
+	for(i = 0; i < N_DICTIONARIES; i++){
+		dicts[n_dicts] = *best;
+		dicts[n_dicts].dict = find_dictionary(tune_dictionaries[i]);
+		dicts[n_dicts].slices = 1;
+		dicts[n_dicts].bytes_in = 0;
+		if(dicts[n_dicts].dict != NULL && dicts[n_dicts].dict != best->dict)
+			n_dicts++;
+	}
+	if(tune_run(&t, dicts, n_dicts) == -1)
+		goto end;
+	for(i = 0; i < n_dicts; i++){
+		if(dicts[i].error)
+			continue;
+		if(opt->verbose)
+			printf("Auto : -t %s : %llu -> %llu bytes of the first slice (%s : %llu)\n",
+			       dicts[i].dict->name, (unsigned long long)dicts[i].bytes_in,
+			       (unsigned long long)dicts[i].first_out, best->dict->name,
+			       (unsigned long long)best->first_out);
+		if(dicts[i].first_out < best->first_out){
+			best->bytes_out = best->bytes_out - best->first_out + dicts[i].first_out;
+			best->first_out = dicts[i].first_out;
+			best->dict = dicts[i].dict;
+		}
+	}
+
+	opt->window_len = best->window_len;
+	opt->look_ahead_len = best->look_ahead_len;
+	opt->dict = best->dict;
+	if(best->fast){
+		opt->max_visits = TUNE_FAST_VISITS;
+		opt->nice_len = TUNE_FAST_NICE;
+		opt->max_depth = TUNE_FAST_DEPTH;
+	}
+	if(opt->verbose)
+		printf("Auto : chosen -w %d -l %d -t %s %s, ratio %.3f at %.2f MB/s on %llu bytes of samples\n",
+		       opt->window_len, opt->look_ahead_len, opt->dict->name, mode_name(best),
+		       best->bytes_out > 0 ? (double)best->bytes_in / best->bytes_out : 0,
+		       candidate_speed(best), (unsigned long long)best->bytes_in);
+	ret = 0;
+
+end:
+	free(t.data);
+	pthread_mutex_destroy(&t.lock);
+	return ret;
+}
@@ -0,0 +1,234 @@
+/**
+ * @file uring.c
+ *
+ * The rings are shared with the kernel: the head of the submission ring and
+ * the tail of the completion ring are written by the kernel, so they are
+ * read with acquire, and the indexes written here are stored with release.
+ *
+ * @author Pischedda Alessandro
+ */
+
+#include <string.h>
+#include <errno.h>
+#include "../include/uring.h"
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned opcode, const void *arg, unsigned n)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, n);
+}
+
+int uring_init(struct uring *ring, unsigned entries)
+{
+	struct io_uring_params p;
+	int err;
+
+	memset(ring, 0, sizeof(struct uring));
+	memset(&p, 0, sizeof(p));
+
+	ring->fd = sys_setup(entries, &p);
+	if(ring->fd == -1)
+		return -1;
+
+	// IORING_OP_READ and IORING_OP_WRITE came with this feature (5.6)
+	if(!(p.features & IORING_FEAT_RW_CUR_POS)){
+		close(ring->fd);
+		errno = ENOSYS;
+		return -1;
+	}
+
+	ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	// the two rings can share the same mapping
+	if(p.features & IORING_FEAT_SINGLE_MMAP){
+		if(ring->cq_size > ring->sq_size)
+			ring->sq_size = ring->cq_size;
+		ring->cq_size = ring->sq_size;
+	}
+
+	ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if(ring->sq_ptr == MAP_FAILED)
+		goto error;
+	if(p.features & IORING_FEAT_SINGLE_MMAP){
+		ring->cq_ptr = ring->sq_ptr;
+	}else{
+		ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if(ring->cq_ptr == MAP_FAILED){
+			munmap(ring->sq_ptr, ring->sq_size);
+			goto error;
+		}
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if(ring->sqes == MAP_FAILED){
+		munmap(ring->sq_ptr, ring->sq_size);
+		if(ring->cq_ptr != ring->sq_ptr)
+			munmap(ring->cq_ptr, ring->cq_size);
+		goto error;
+	}
+
+	ring->sq_head = (unsigned*)((char*)ring->sq_ptr + p.sq_off.head);
+	ring->sq_tail = (unsigned*)((char*)ring->sq_ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned*)((char*)ring->sq_ptr + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)((char*)ring->sq_ptr + p.sq_off.array);
+	ring->cq_head = (unsigned*)((char*)ring->cq_ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned*)((char*)ring->cq_ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned*)((char*)ring->cq_ptr + p.cq_off.ring_mask);
+	ring->cqes = (char*)ring->cq_ptr + p.cq_off.cqes;
+
+	return 0;
+
+error:
+	err = errno;
+	close(ring->fd);
+	errno = err;
+	return -1;
+}
+
+int uring_register(struct uring *ring, const struct iovec *iov, unsigned n)
+{
+	if(sys_register(ring->fd, IORING_REGISTER_BUFFERS, iov, n) == -1)
+		return -1;
+	ring->registered = 1;
+	return 0;
+}
+
+void uring_prep(struct uring *ring, int op, int fd, void *buf, unsigned len,
+		uint64_t off, unsigned index, void *data)
+{
+	unsigned tail = *ring->sq_tail;
+	unsigned slot = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = (struct io_uring_sqe*)ring->sqes + slot;
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	if(ring->registered){
+		sqe->opcode = op == URING_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+		sqe->buf_index = index;
+	}else{
+		sqe->opcode = op == URING_READ ? IORING_OP_READ : IORING_OP_WRITE;
+	}
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = off;
+	sqe->user_data = (uintptr_t)data;
+
+	ring->sq_array[slot] = slot;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->to_submit++;
+}
+
+int uring_wait(struct uring *ring, void **data, int *res)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head;
+	int ret;
+
+	for(;;){
+		head = *ring->cq_head;
+		if(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)){
+			cqe = (struct io_uring_cqe*)ring->cqes + (head & *ring->cq_mask);
+			*data = (void*)(uintptr_t)cqe->user_data;
+			*res = cqe->res;
+			__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+			return 0;
+		}
+
+		ret = sys_enter(ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS);
+		if(ret == -1){
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		ring->to_submit -= ret;
+	}
+}
+
+int uring_drain(struct uring *ring, int n)
+{
+	unsigned head;
+	int ret;
+
+	// the kernel reads the submission ring only in sys_enter()
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail - ring->to_submit, __ATOMIC_RELEASE);
+	n -= ring->to_submit;
+	ring->to_submit = 0;
+
+	while(n > 0){
+		head = *ring->cq_head;
+		if(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)){
+			__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+			n--;
+			continue;
+		}
+
+		ret = sys_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+		if(ret == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			return -1;
+	}
+	return 0;
+}
+
+void uring_exit(struct uring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if(ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_size);
+	munmap(ring->sq_ptr, ring->sq_size);
+	close(ring->fd);
+}
+
+#else
+
+int uring_init(struct uring *ring, unsigned entries)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_register(struct uring *ring, const struct iovec *iov, unsigned n)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+void uring_prep(struct uring *ring, int op, int fd, void *buf, unsigned len,
+		uint64_t off, unsigned index, void *data)
+{
+}
+
+int uring_wait(struct uring *ring, void **data, int *res)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_drain(struct uring *ring, int n)
+{
+	return 0;
+}
+
+void uring_exit(struct uring *ring)
+{
+}
+
+#endif
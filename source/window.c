@@ -3,7 +3,6 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
 #include <arpa/inet.h>
 #include "../include/window.h"
      
@@ -23,49 +22,48 @@ int number_of_bits(int x){
 		return -1;
 	}
 		
-	// log(8)/ log(2) = 3 but with 3 bit I haven't the number 8
-	// so I must add 1 bit 	
-	return (int)(log(x)/log(2) +1);
+	// the position of the highest bit set plus 1: 8 needs 4 bits, 7 needs 3
+	return x == 0 ? 1 : 32 - __builtin_clz(x);
 }
 
-int load_dictionary(const struct window* w, char* filename){
+void set_token_codes(struct token_codes *codes, int max_length, int bits_position, int flags){
 
-    FILE *dict = NULL;
-    int quanti,resto;
-    int ret,i;
+	codes->max_length = max_length;
+	codes->eof = max_length + 1;
+	codes->forward = max_length + 2;
+	codes->block = max_length + 3;
+	codes->literals = flags & HEADER_LITERAL_RUNS ? max_length + 4 : -1;
+	codes->widths = flags & HEADER_BLOCK_WIDTHS ? max_length + 5 : -1;
 
-    // open the dictionary file
-    dict = fopen(filename,"r");
+	// the length field must hold the last code
+	codes->bits_length = number_of_bits(codes->widths != -1 ? codes->widths :
+					    codes->literals != -1 ? codes->literals : codes->block);
+	codes->bits_position = bits_position;
+}
 
-    if (dict == NULL) {
-		errno = EINVAL;
-		return -1;
+int load_dictionary(const struct window* w, const struct dictionary *dict){
+
+    int quanti,resto;
+    int i;
+
+    if(w == NULL || dict == NULL || dict->length <= 0){
+	errno = EINVAL;
+	return -1;
     }
 
-    quanti = w->window_length;
- 
-    i = 0;
+    quanti = dict->length < w->window_length ? dict->length : w->window_length;
+
     // preload dictionary in window
-    ret = fread(w->window, 1, w->window_length, dict);
-    if(ferror(dict)){
-        printf("Some error occured with dictionary\n");
-	fclose(dict);
-	free(w->window);
-        return -1;
-    } 
-    fclose(dict);
-
-    // (window_length - ret)/ret = window/ret -1
-    quanti = (w->window_length)/ret -1;
-    resto =  (w->window_length - ret)%ret;   
-   
-    for(i=1; i<=quanti; i++)
-	strncpy((char*)(w->window + (ret*i)),(char*)(w->window),ret);	
-     
+    memcpy(w->window, dict->data, quanti);
+
+    // repeat the dictionary until the window is full
+    for(i = quanti; i + quanti <= w->window_length; i += quanti)
+	memcpy(w->window + i, w->window, quanti);
+
+    resto = w->window_length - i;
     if(resto)
-	strncpy((char*)(w->window + (ret*quanti)),(char*)(w->window),resto);	
+	memcpy(w->window + i, w->window, resto);
 
-	
     return 0;
 }
 
@@ -84,13 +82,27 @@ struct header * build_header(const struct options *opt){
 	if(header == NULL)
 		return NULL;
 
-	// init
+	init_header(header, opt);
+	return header;
+}
+
+
+int init_header(struct header *header, const struct options *opt){
+
+	if(header == NULL || opt == NULL ){
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(header, 0, sizeof(struct header));
 	header->magic[0] = 1;
 	header->magic[1] = 9;
 	header->magic[2] = 8;
 	header->magic[3] = 4;
-	header->header_len = 12;
-	header->ver = 1;
+	header->header_len = 16;
+	// the older versions know only the checksums, with another version
+	// number they refuse the file instead of reading garbage
+	header->ver = opt->fast_decode || opt->literal_runs || opt->block_widths ? 3 : 2;
 	/* Test for a little-endian machine */
 	#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 		header->byte_order = LITTLE_EN;
@@ -100,9 +112,20 @@ struct header * build_header(const struct options *opt){
 	
 	header->look_ah_len = opt->look_ahead_len;
 	header->window_len = htons(opt->window_len);
-	strncpy(header->dict, opt->dict,2);
+	header->dict_id = htonl(dictionary_id(opt->dict));
+	if(opt->checksum)
+		header->flags |= HEADER_CHECKSUM;
+	if(opt->fast_decode)
+		header->flags |= HEADER_BYTES;
+	else{
+		if(opt->literal_runs)
+			header->flags |= HEADER_LITERAL_RUNS;
+		if(opt->block_widths)
+			header->flags |= HEADER_BLOCK_WIDTHS;
+	}
+	header->flags = htons(header->flags);
 
-	return header;
+	return 0;
 }
 
 
@@ -146,8 +169,13 @@ int write_header(struct bitfile *b_file, const struct header *h){
 	if(ret == -1)
 		return -1;
 	
-	// write dictionary name [16 bits]	
-	ret = bit_write(b_file,h->dict,16,0);
+	// write flags [16 bits]
+	ret = bit_write(b_file,(char*)(&h->flags),16,0);
+	if(ret == -1)
+		return -1;
+
+	// write dictionary ID [32 bits]	
+	ret = bit_write(b_file,(char*)(&h->dict_id),32,0);
 	if(ret == -1)
 		return -1;
 
@@ -170,7 +198,7 @@ int read_header(struct bitfile *b_file, struct header *h){
 		return -1;
 
 
-	if( (h->magic[0] != 1) && (h->magic[1] != 9) && (h->magic[2] != 8) && (h->magic[3] != 4) ){
+	if( (h->magic[0] != 1) || (h->magic[1] != 9) || (h->magic[2] != 8) || (h->magic[3] != 4) ){
 		printf("This file isn't compatible with this software\n");
 		return -1;
 	}
@@ -186,6 +214,11 @@ int read_header(struct bitfile *b_file, struct header *h){
 	ret = bit_read(b_file, (char*)(&h->ver), 8, 0);
 	if (ret == -1)
 		return -1;
+
+	if( h->ver != 2 && h->ver != 3 ){
+		printf("This file was made by an unsupported version (%d) of this software\n", h->ver);
+		return -1;
+	}
 	
 	ret = bit_read(b_file, (char*)(&h->byte_order),8 , 0);
 	if (ret == -1)
@@ -200,11 +233,24 @@ int read_header(struct bitfile *b_file, struct header *h){
 	if (ret == -1)
 		return -1;
 
-	ret = bit_read(b_file, h->dict, 16, 0);
+	ret = bit_read(b_file, (char*)(&h->flags), 16, 0);
+	if (ret == -1)
+		return -1;
+
+	ret = bit_read(b_file, (char*)(&h->dict_id), 32, 0);
 	if (ret == -1)
 		return -1;
 
 	h->window_len = ntohs(h->window_len);
+	h->flags = ntohs(h->flags);
+	h->dict_id = ntohl(h->dict_id);
+
+	if( (h->flags & ~(HEADER_CHECKSUM | HEADER_BYTES | HEADER_LITERAL_RUNS | HEADER_BLOCK_WIDTHS)) ||
+	    (h->ver == 2 && (h->flags & ~HEADER_CHECKSUM)) ){
+		printf("This file uses features (flags %04x) unsupported by this software\n", h->flags);
+		errno = EINVAL;
+		return -1;
+	}
 
 	return 0;
 }